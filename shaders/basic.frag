@@ -15,16 +15,17 @@ uniform vec3 ambient_color;
 uniform vec3 diffuse_color;
 uniform vec3 specular_color;
 
+uniform sampler2D diffuse_texture;
+uniform int use_texture;
+
 void main()
 {
-    vec3 calc_normal;
-    // If no normals, derive them from the derivative of the position
-    if (normal == vec3(0,0,0)) {
-        vec3 dFdxPos = dFdx(world_position);
-        vec3 dFdyPos = dFdy(world_position);
-        calc_normal = normalize( cross( dFdxPos, dFdyPos ) );
-    } else {
-        calc_normal = normalize(normal);
+    // Meshes without normals get them generated at load time
+    vec3 calc_normal = normalize(normal);
+
+    vec3 surface_color = diffuse_color;
+    if (use_texture != 0) {
+        surface_color *= texture2D(diffuse_texture, uv).rgb;
     }
 
     vec3 light_dir = normalize(light_position - world_position);
@@ -39,6 +40,6 @@ void main()
     }
 
     gl_FragColor = vec4( ambient_coefficient * ambient_color +
-            diffuse_coefficient * lambertian * diffuse_color +
+            diffuse_coefficient * lambertian * surface_color +
             specular_coefficient * specular * specular_color, 1.0);
 }
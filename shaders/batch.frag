@@ -0,0 +1,32 @@
+#version 430
+#define MAX_VIEWS 32
+in vec3 world_position;
+in vec3 normal;
+flat in int view;
+out vec4 frag_color;
+
+// camera position of every view, the light sits 10 units above it
+uniform vec3 eye[MAX_VIEWS];
+
+uniform float shininess;
+
+uniform vec3 ambient_color;
+uniform vec3 diffuse_color;
+uniform vec3 specular_color;
+
+void main()
+{
+    vec3 calc_normal = normalize(normal);
+    vec3 light_dir = normalize(eye[view] + vec3(0.0, 10.0, 0.0) - world_position);
+
+    float lambertian = max(dot(calc_normal, light_dir), 0.0);
+    float specular = 0.0;
+    if (lambertian > 0.0) {
+        vec3 reflected_light_dir = reflect(-light_dir, calc_normal);
+        vec3 viewer = normalize(eye[view] - world_position);
+        float specAngle = max(dot(reflected_light_dir, viewer), 0.0);
+        specular = pow(specAngle, shininess);
+    }
+
+    frag_color = vec4(ambient_color + lambertian * diffuse_color + specular * specular_color, 1.0);
+}
@@ -0,0 +1,16 @@
+#version 430
+uniform float scale;
+in vec3 vPos;
+in vec3 vNormal;
+out vec3 v_position;
+out vec3 v_normal;
+flat out int v_view;
+
+void main()
+{
+    // Projected per view in the geometry shader, which also picks the layer
+    v_position = vPos * scale;
+    v_normal = vNormal;
+    v_view = gl_InstanceID;
+    gl_Position = vec4(v_position, 1.0);
+}
@@ -0,0 +1,140 @@
+#include "allocation_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+void count_allocation(size_t bytes);
+void count_deallocation(size_t bytes);
+
+namespace {
+thread_local AllocationCounter* active_counter = nullptr;
+
+// Every block starts with its size so deletes can be counted without relying
+// on sized deallocation. The header keeps the alignment operator new promises.
+constexpr size_t header_size = alignof(std::max_align_t);
+static_assert(header_size >= sizeof(size_t));
+
+void* allocate(size_t bytes)
+{
+    void* block = std::malloc(header_size + bytes);
+    if (!block) {
+        return nullptr;
+    }
+    *static_cast<size_t*>(block) = bytes;
+    count_allocation(bytes);
+    return static_cast<char*>(block) + header_size;
+}
+
+void deallocate(void* p) noexcept
+{
+    if (!p) {
+        return;
+    }
+    void* block = static_cast<char*>(p) - header_size;
+    count_deallocation(*static_cast<size_t*>(block));
+    std::free(block);
+}
+
+void* allocate_or_throw(size_t bytes)
+{
+    while (true) {
+        if (void* p = allocate(bytes)) {
+            return p;
+        }
+        auto handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+}
+
+void count_allocation(size_t bytes)
+{
+    for (auto* counter = active_counter; counter; counter = counter->outer) {
+        counter->allocations++;
+        counter->total += bytes;
+        counter->current += bytes;
+        if (counter->current > counter->peak) {
+            counter->peak = counter->current;
+        }
+    }
+}
+
+void count_deallocation(size_t bytes)
+{
+    for (auto* counter = active_counter; counter; counter = counter->outer) {
+        counter->deallocations++;
+        counter->current -= bytes < counter->current ? bytes : counter->current;
+    }
+}
+
+AllocationCounter::AllocationCounter()
+    : outer(active_counter)
+{
+    active_counter = this;
+}
+
+AllocationCounter::~AllocationCounter()
+{
+    active_counter = outer;
+}
+
+void* operator new(size_t bytes)
+{
+    return allocate_or_throw(bytes);
+}
+
+void* operator new[](size_t bytes)
+{
+    return allocate_or_throw(bytes);
+}
+
+void* operator new(size_t bytes, const std::nothrow_t&) noexcept
+{
+    try {
+        return allocate_or_throw(bytes);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t bytes, const std::nothrow_t&) noexcept
+{
+    try {
+        return allocate_or_throw(bytes);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* p) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    deallocate(p);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+
+// Counts every global operator new and delete made by the current thread
+// while it is alive, including those of the standard library and spdlog.
+// Counters nest: an inner one only sees what happens during its own lifetime.
+class AllocationCounter {
+public:
+    AllocationCounter();
+    ~AllocationCounter();
+
+    AllocationCounter(const AllocationCounter&) = delete;
+    AllocationCounter& operator=(const AllocationCounter&) = delete;
+
+    size_t allocation_count() const { return allocations; }
+    size_t deallocation_count() const { return deallocations; }
+    size_t total_bytes() const { return total; }
+    // Highest amount of memory allocated during the lifetime of the counter
+    // and not yet freed, blocks freed that were allocated before it started
+    // are not subtracted
+    size_t peak_bytes() const { return peak; }
+
+private:
+    friend void count_allocation(size_t bytes);
+    friend void count_deallocation(size_t bytes);
+
+    AllocationCounter* outer;
+
+    size_t allocations = 0;
+    size_t deallocations = 0;
+    size_t total = 0;
+    size_t current = 0;
+    size_t peak = 0;
+};
@@ -0,0 +1,352 @@
+#include "batch_renderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <fmt/format.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <spdlog/spdlog.h>
+
+#include "mesh.h"
+#include "shader.h"
+
+namespace {
+// Shared by all workers, the passes are handed out through next_pass
+struct BatchJob {
+    GLuint vertex_buffer;
+    GLuint index_buffer;
+    GLsizei index_count;
+    float scale;
+    const std::vector<CameraPose>& poses;
+    const BatchOptions& options;
+
+    size_t views_per_pass; // at most BATCH_VIEWS_PER_PASS
+    size_t pass_count;
+    std::atomic<size_t> next_pass { 0 };
+    std::atomic<bool> failed { false };
+};
+
+struct WorkerStats {
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+    size_t passes = 0;
+    size_t views = 0;
+};
+
+// A pass whose layers are being copied into a pixel pack buffer
+struct Readback {
+    GLuint buffer;
+    size_t first_view;
+    size_t view_count;
+};
+
+// Readbacks are double buffered, a pass is written to disk while the next
+// one renders
+constexpr size_t READBACK_BUFFER_COUNT = 2;
+
+bool write_ppm(const std::string& filename, const unsigned char* rgb, int width, int height)
+{
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        spdlog::error("Could not open \"{}\"", filename);
+        return false;
+    }
+    file << "P6\n"
+         << width << " " << height << "\n255\n";
+    // GL rows start at the bottom of the image
+    size_t row_size = width * 3;
+    for (int y = height - 1; y >= 0; --y) {
+        file.write(reinterpret_cast<const char*>(rgb + y * row_size), row_size);
+    }
+    return static_cast<bool>(file);
+}
+
+void render_passes(GLFWwindow* context, BatchJob& job, WorkerStats& stats)
+{
+    glfwMakeContextCurrent(context);
+
+    const BatchOptions& options = job.options;
+    int width = options.view_width;
+    int height = options.view_height;
+    bool readback = !options.output_dir.empty();
+    size_t layer_size = size_t(width) * height * 3;
+
+    // Scope so the shader program is deleted while the context is still current
+    {
+        ShaderProgram shader("shaders/batch.vert", "shaders/batch.frag", "shaders/batch.geom");
+
+        // Vertex array objects are not shared between contexts, the buffers they point at are
+        GLuint vao;
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, job.vertex_buffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, job.index_buffer);
+
+        GLint vpos_location = shader.get_attribute_location("vPos");
+        GLint vnorm_location = shader.get_attribute_location("vNormal");
+        if (vpos_location == -1 || vnorm_location == -1) {
+            spdlog::error("Could not get the attribute locations of the batch shader");
+            job.failed = true;
+        } else {
+            glEnableVertexAttribArray(vpos_location);
+            glVertexAttribPointer(vpos_location, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+            glEnableVertexAttribArray(vnorm_location);
+            glVertexAttribPointer(vnorm_location, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(sizeof(float) * 5));
+        }
+
+        // One layer per view of a pass. Attaching whole array textures makes
+        // the framebuffer layered, the geometry shader picks the layer.
+        GLuint color_texture, depth_texture;
+        glGenTextures(1, &color_texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, color_texture);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGB8, width, height, BATCH_VIEWS_PER_PASS);
+        glGenTextures(1, &depth_texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, depth_texture);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT24, width, height, BATCH_VIEWS_PER_PASS);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        GLuint framebuffer;
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color_texture, 0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            spdlog::error("Batch framebuffer of {} {}x{} layers is incomplete", BATCH_VIEWS_PER_PASS, width, height);
+            job.failed = true;
+        }
+
+        GLuint readback_buffers[READBACK_BUFFER_COUNT] = {};
+        size_t next_readback_buffer = 0;
+        std::optional<Readback> pending;
+        if (readback) {
+            glGenBuffers(READBACK_BUFFER_COUNT, readback_buffers);
+            for (GLuint buffer : readback_buffers) {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+                glBufferData(GL_PIXEL_PACK_BUFFER, layer_size * BATCH_VIEWS_PER_PASS, nullptr, GL_STREAM_READ);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        }
+
+        auto write_views = [&](const Readback& done) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, done.buffer);
+            auto pixels = static_cast<const unsigned char*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, layer_size * done.view_count, GL_MAP_READ_BIT));
+            if (!pixels) {
+                spdlog::error("Could not map the readback buffer of views {} to {}", done.first_view, done.first_view + done.view_count - 1);
+                job.failed = true;
+            } else {
+                for (size_t i = 0; i < done.view_count; ++i) {
+                    auto filename = fmt::format("{}/view_{:04}.ppm", options.output_dir, done.first_view + i);
+                    if (!write_ppm(filename, pixels + i * layer_size, width, height)) {
+                        job.failed = true;
+                    }
+                }
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        };
+
+        glm::mat4 projection = glm::perspective(glm::radians(45.f), width / (float)height, .1f, 100.f);
+        std::vector<glm::mat4> view_projections;
+        std::vector<glm::vec3> eyes;
+
+        glViewport(0, 0, width, height);
+        glEnable(GL_DEPTH_TEST);
+        glClearColor(0.0, 0.0, 0.0, 1.0);
+
+        // Same material as the interactive view
+        shader.use();
+        shader.set_uniform_float("scale", job.scale);
+        shader.set_uniform_vec3("ambient_color", glm::vec3(0.1f, 0.1f, 0.2f));
+        shader.set_uniform_vec3("diffuse_color", glm::vec3(0.5f, 0.5f, 0.9f));
+        shader.set_uniform_vec3("specular_color", glm::vec3(1.f, 1.f, 1.f));
+        shader.set_uniform_float("shininess", 80.f);
+
+        stats.start = std::chrono::steady_clock::now();
+        while (!job.failed) {
+            size_t pass = job.next_pass.fetch_add(1);
+            if (pass >= job.pass_count) {
+                break;
+            }
+            size_t first_view = pass * job.views_per_pass;
+            size_t view_count = std::min(job.views_per_pass, job.poses.size() - first_view);
+
+            view_projections.clear();
+            eyes.clear();
+            for (size_t i = first_view; i < first_view + view_count; ++i) {
+                const CameraPose& pose = job.poses[i];
+                view_projections.push_back(projection * glm::lookAt(pose.position, pose.target, pose.up));
+                eyes.push_back(pose.position);
+            }
+            shader.set_uniform_mat4_array("view_projection", view_projections);
+            shader.set_uniform_vec3_array("eye", eyes);
+
+            // Clears every layer, then each instance draws the mesh into its own
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glDrawElementsInstanced(GL_TRIANGLES, job.index_count, GL_UNSIGNED_INT, nullptr, view_count);
+
+            if (readback) {
+                Readback started { readback_buffers[next_readback_buffer], first_view, view_count };
+                next_readback_buffer = (next_readback_buffer + 1) % READBACK_BUFFER_COUNT;
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, started.buffer);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, color_texture);
+                glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+                if (pending) {
+                    write_views(*pending);
+                }
+                pending = started;
+            }
+
+            stats.passes++;
+            stats.views += view_count;
+        }
+        if (pending) {
+            write_views(*pending);
+        }
+        glFinish();
+        stats.end = std::chrono::steady_clock::now();
+
+        if (readback) {
+            glDeleteBuffers(READBACK_BUFFER_COUNT, readback_buffers);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &color_texture);
+        glDeleteTextures(1, &depth_texture);
+        glDeleteVertexArrays(1, &vao);
+    }
+
+    glfwMakeContextCurrent(nullptr);
+}
+}
+
+std::vector<CameraPose> turntable_poses(int count, float radius, float height)
+{
+    std::vector<CameraPose> poses;
+    for (int i = 0; i < count; ++i) {
+        float angle = glm::radians(360.f) * i / count;
+        CameraPose pose;
+        pose.position = glm::vec3(radius * std::cos(angle), height, radius * std::sin(angle));
+        pose.target = glm::vec3(0.f);
+        pose.up = glm::vec3(0.f, 1.f, 0.f);
+        poses.push_back(pose);
+    }
+    return poses;
+}
+
+std::optional<std::vector<CameraPose>> read_camera_poses(const std::string& filename)
+{
+    std::ifstream file(filename);
+    if (!file) {
+        spdlog::error("Could not open \"{}\"", filename);
+        return {};
+    }
+
+    std::vector<CameraPose> poses;
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::stringstream stream(line);
+        CameraPose pose;
+        stream >> pose.position.x >> pose.position.y >> pose.position.z
+            >> pose.target.x >> pose.target.y >> pose.target.z
+            >> pose.up.x >> pose.up.y >> pose.up.z;
+        if (!stream) {
+            spdlog::error("Invalid camera pose on line {} of \"{}\"", line_number, filename);
+            return {};
+        }
+        poses.push_back(pose);
+    }
+
+    spdlog::info("Read {} camera poses from \"{}\"", poses.size(), filename);
+    return poses;
+}
+
+bool render_batch(GLFWwindow* shared_context, GLuint vertex_buffer, GLuint index_buffer, GLsizei index_count, float scale,
+    const std::vector<CameraPose>& poses, const BatchOptions& options)
+{
+    if (poses.empty()) {
+        spdlog::warn("No camera poses to render");
+        return true;
+    }
+    if (options.view_width <= 0 || options.view_height <= 0) {
+        spdlog::error("Invalid view size {}x{}", options.view_width, options.view_height);
+        return false;
+    }
+    if (!options.output_dir.empty()) {
+        std::error_code error;
+        std::filesystem::create_directories(options.output_dir, error);
+        if (error) {
+            spdlog::error("Could not create \"{}\": {}", options.output_dir, error.message());
+            return false;
+        }
+    }
+
+    // The workers' contexts only see the mesh upload once it has completed
+    glFinish();
+
+    // Jobs too small to give every thread a full pass are split into smaller
+    // passes, one per thread
+    unsigned requested_threads = std::max(options.thread_count, 1u);
+    size_t views_per_pass = std::clamp<size_t>((poses.size() + requested_threads - 1) / requested_threads, 1, BATCH_VIEWS_PER_PASS);
+    BatchJob job { vertex_buffer, index_buffer, index_count, scale, poses, options, views_per_pass, (poses.size() + views_per_pass - 1) / views_per_pass };
+    unsigned thread_count = std::min<size_t>(requested_threads, job.pass_count);
+    if (thread_count < options.thread_count) {
+        spdlog::warn("Only {} views to render, using {} of the {} requested threads", poses.size(), thread_count, options.thread_count);
+    }
+
+    // Windows can only be created on the main thread, the workers just make them current
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    std::vector<GLFWwindow*> contexts;
+    for (unsigned i = 0; i < thread_count; ++i) {
+        GLFWwindow* context = glfwCreateWindow(1, 1, "Batch worker", NULL, shared_context);
+        if (!context) {
+            spdlog::error("Could not create a shared context for batch worker {}", i);
+            break;
+        }
+        contexts.push_back(context);
+    }
+
+    if (contexts.size() == thread_count) {
+        std::vector<WorkerStats> stats(thread_count);
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < thread_count; ++i) {
+            workers.emplace_back(render_passes, contexts[i], std::ref(job), std::ref(stats[i]));
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        if (!job.failed) {
+            auto start = std::min_element(stats.begin(), stats.end(), [](auto& a, auto& b) { return a.start < b.start; })->start;
+            auto end = std::max_element(stats.begin(), stats.end(), [](auto& a, auto& b) { return a.end < b.end; })->end;
+            double seconds = std::chrono::duration<double>(end - start).count();
+            for (unsigned i = 0; i < thread_count; ++i) {
+                spdlog::info("Batch worker {}: {} views in {} passes", i, stats[i].views, stats[i].passes);
+            }
+            fmt::print("Rendered {} views of {}x{} in {} passes on {} threads: {:.3f} s, {:.1f} views/s\n",
+                poses.size(), options.view_width, options.view_height, job.pass_count, thread_count, seconds, poses.size() / seconds);
+        }
+    } else {
+        job.failed = true;
+    }
+
+    for (auto context : contexts) {
+        glfwDestroyWindow(context);
+    }
+    glfwMakeContextCurrent(shared_context);
+    return !job.failed;
+}
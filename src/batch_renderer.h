@@ -0,0 +1,49 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <epoxy/gl.h>
+
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+// Views rendered by one instanced draw, must match MAX_VIEWS in shaders/batch.geom
+// and shaders/batch.frag
+constexpr int BATCH_VIEWS_PER_PASS = 32;
+
+struct CameraPose {
+    glm::vec3 position;
+    glm::vec3 target;
+    glm::vec3 up;
+};
+
+// count poses evenly spaced around the y axis, looking at the origin from
+// radius away and height above it
+std::vector<CameraPose> turntable_poses(int count, float radius, float height);
+
+// One pose per line, position, target and up as 9 numbers. Empty lines and
+// lines starting with # are skipped.
+std::optional<std::vector<CameraPose>> read_camera_poses(const std::string& filename);
+
+struct BatchOptions {
+    int view_width = 512;
+    int view_height = 512;
+    unsigned thread_count = 2;
+    std::string output_dir; // views are written as view_NNNN.ppm, nothing is written if empty
+};
+
+// Renders the mesh in vertex_buffer and index_buffer once per pose, then
+// prints how many views per second were rendered.
+//
+// Every worker thread gets a hidden window whose context shares objects with
+// shared_context, so the mesh is uploaded once. A worker renders up to
+// BATCH_VIEWS_PER_PASS views with a single instanced draw, each instance
+// going to its own layer of an array texture framebuffer. Fewer views go
+// into each pass when that is needed to keep every thread busy.
+//
+// Must be called on the main thread with shared_context current. Returns
+// false if a worker could not be set up.
+bool render_batch(GLFWwindow* shared_context, GLuint vertex_buffer, GLuint index_buffer, GLsizei index_count, float scale,
+    const std::vector<CameraPose>& poses, const BatchOptions& options);
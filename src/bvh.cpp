@@ -0,0 +1,437 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+#include "utils.h"
+
+namespace {
+constexpr int BIN_COUNT = 16;
+constexpr uint32_t MAX_LEAF_SIZE = 4; // one triangle block
+constexpr float TRAVERSAL_COST = 1.0f; // relative to intersecting a triangle
+// Subtrees with fewer triangles are not worth another thread
+constexpr uint32_t PARALLEL_BUILD_MIN = 16 * 1024;
+// Deeper nodes are split at the median, which bounds the depth of the tree
+// and with it the traversal stack
+constexpr unsigned SAH_MAX_DEPTH = 64;
+constexpr size_t STACK_SIZE = SAH_MAX_DEPTH + 64;
+
+struct Aabb {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+    void extend(const glm::vec3& point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void extend(const Aabb& other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    float area() const
+    {
+        glm::vec3 size = max - min;
+        if (size.x < 0.0f) {
+            return 0.0f;
+        }
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+};
+
+// A triangle as seen by the build, partitioned in place so that every node
+// owns a contiguous range
+struct BuildTriangle {
+    Aabb bounds;
+    glm::vec3 centroid;
+    uint32_t index; // into the mesh's indices
+};
+
+int bin_of(float centroid, float min, float bin_scale)
+{
+    return std::min(int((centroid - min) * bin_scale), BIN_COUNT - 1);
+}
+
+// Appends the subtree over triangles [begin, end) to nodes. Leaves store the
+// start of their range in first until the triangle blocks are built.
+void build_node(std::vector<BuildTriangle>& triangles, uint32_t begin, uint32_t end, std::vector<BvhNode>& nodes, unsigned depth, unsigned parallel_depth)
+{
+    Aabb bounds;
+    Aabb centroid_bounds;
+    for (uint32_t i = begin; i < end; ++i) {
+        bounds.extend(triangles[i].bounds);
+        centroid_bounds.extend(triangles[i].centroid);
+    }
+
+    size_t node_index = nodes.size();
+    BvhNode node;
+    for (int axis = 0; axis < 3; ++axis) {
+        node.bounds_min[axis] = bounds.min[axis];
+        node.bounds_max[axis] = bounds.max[axis];
+    }
+    node.first = begin;
+    node.count = end - begin;
+    nodes.push_back(node);
+
+    uint32_t count = end - begin;
+    if (count == 1) {
+        return;
+    }
+
+    // Find the cheapest split between bins of centroids along any axis
+    int best_axis = -1;
+    int best_bin = 0;
+    float best_cost = std::numeric_limits<float>::infinity();
+    glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+    float node_area = bounds.area();
+    if (depth < SAH_MAX_DEPTH && node_area > 0.0f) {
+        float bin_scales[3];
+        for (int axis = 0; axis < 3; ++axis) {
+            bin_scales[axis] = extent[axis] > 0.0f ? BIN_COUNT / extent[axis] : 0.0f;
+        }
+
+        // All three axes are binned in one pass over the triangles
+        Aabb bin_bounds[3][BIN_COUNT];
+        uint32_t bin_counts[3][BIN_COUNT] = {};
+        for (uint32_t i = begin; i < end; ++i) {
+            const BuildTriangle& triangle = triangles[i];
+            for (int axis = 0; axis < 3; ++axis) {
+                int bin = bin_of(triangle.centroid[axis], centroid_bounds.min[axis], bin_scales[axis]);
+                bin_bounds[axis][bin].extend(triangle.bounds);
+                bin_counts[axis][bin]++;
+            }
+        }
+
+        for (int axis = 0; axis < 3; ++axis) {
+            if (!(extent[axis] > 0.0f)) {
+                continue;
+            }
+
+            // Sweep from the right to get the cost of everything right of each split
+            float right_costs[BIN_COUNT - 1];
+            Aabb right_bounds;
+            uint32_t right_count = 0;
+            for (int bin = BIN_COUNT - 1; bin > 0; --bin) {
+                right_bounds.extend(bin_bounds[axis][bin]);
+                right_count += bin_counts[axis][bin];
+                right_costs[bin - 1] = right_bounds.area() * right_count;
+            }
+
+            Aabb left_bounds;
+            uint32_t left_count = 0;
+            for (int bin = 0; bin < BIN_COUNT - 1; ++bin) {
+                left_bounds.extend(bin_bounds[axis][bin]);
+                left_count += bin_counts[axis][bin];
+                if (left_count == 0 || left_count == count) {
+                    continue;
+                }
+                float cost = TRAVERSAL_COST + (left_bounds.area() * left_count + right_costs[bin]) / node_area;
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = bin;
+                }
+            }
+        }
+    }
+
+    if (count <= MAX_LEAF_SIZE && (best_axis == -1 || float(count) <= best_cost)) {
+        return;
+    }
+
+    uint32_t middle = begin + count / 2;
+    auto first = triangles.begin();
+    if (best_axis != -1) {
+        float bin_scale = BIN_COUNT / extent[best_axis];
+        float min = centroid_bounds.min[best_axis];
+        auto split = std::partition(first + begin, first + end, [&](const BuildTriangle& triangle) {
+            return bin_of(triangle.centroid[best_axis], min, bin_scale) <= best_bin;
+        });
+        middle = split - first;
+    } else {
+        // Too deep or all centroids in one spot, split the widest axis at the median
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        std::nth_element(first + begin, first + middle, first + end, [axis](const BuildTriangle& a, const BuildTriangle& b) {
+            return a.centroid[axis] < b.centroid[axis];
+        });
+    }
+
+    nodes[node_index].count = 0;
+    if (parallel_depth > 0 && count >= PARALLEL_BUILD_MIN) {
+        // The right subtree is built on its own thread and appended afterwards
+        std::vector<BvhNode> right_nodes;
+        std::thread right_builder([&]() { build_node(triangles, middle, end, right_nodes, depth + 1, parallel_depth - 1); });
+        build_node(triangles, begin, middle, nodes, depth + 1, parallel_depth - 1);
+        right_builder.join();
+
+        uint32_t offset = nodes.size();
+        nodes[node_index].first = offset;
+        for (BvhNode right_node : right_nodes) {
+            if (right_node.count == 0) {
+                right_node.first += offset;
+            }
+            nodes.push_back(right_node);
+        }
+    } else {
+        build_node(triangles, begin, middle, nodes, depth + 1, parallel_depth);
+        nodes[node_index].first = nodes.size();
+        build_node(triangles, middle, end, nodes, depth + 1, parallel_depth);
+    }
+}
+
+// Distance at which ray enters node, infinity if it misses it or only enters
+// it beyond max_distance
+float enter_node(const BvhNode& node, const Ray& ray, const float inverse_direction[3], float max_distance)
+{
+    float t_min = 0.0f;
+    float t_max = max_distance;
+    for (int axis = 0; axis < 3; ++axis) {
+        float t0 = (node.bounds_min[axis] - ray.origin[axis]) * inverse_direction[axis];
+        float t1 = (node.bounds_max[axis] - ray.origin[axis]) * inverse_direction[axis];
+        t_min = std::max(t_min, std::min(t0, t1));
+        t_max = std::min(t_max, std::max(t0, t1));
+    }
+    return t_min <= t_max ? t_min : std::numeric_limits<float>::infinity();
+}
+
+// Moller-Trumbore against all lanes of block, updating hit if one of them is
+// closer. Returns whether it did.
+bool intersect_block(const BvhTriangleBlock& block, const Ray& ray, RayHit& hit)
+{
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 dx = _mm_set1_ps(ray.direction.x);
+    __m128 dy = _mm_set1_ps(ray.direction.y);
+    __m128 dz = _mm_set1_ps(ray.direction.z);
+
+    __m128 e1x = _mm_load_ps(block.edge1[0]);
+    __m128 e1y = _mm_load_ps(block.edge1[1]);
+    __m128 e1z = _mm_load_ps(block.edge1[2]);
+    __m128 e2x = _mm_load_ps(block.edge2[0]);
+    __m128 e2y = _mm_load_ps(block.edge2[1]);
+    __m128 e2z = _mm_load_ps(block.edge2[2]);
+
+    // p = direction x edge2
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 inverse_det = _mm_div_ps(one, det);
+
+    // s = origin - v0
+    __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_load_ps(block.v0[0]));
+    __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_load_ps(block.v0[1]));
+    __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_load_ps(block.v0[2]));
+    __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverse_det);
+
+    // q = s x edge1
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverse_det);
+    __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverse_det);
+
+    // Comparisons with NaN are false, so degenerate lanes drop out here too
+    __m128 mask = _mm_cmpneq_ps(det, zero);
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, zero));
+    mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(hit.distance)));
+    int lanes = _mm_movemask_ps(mask);
+    if (lanes == 0) {
+        return false;
+    }
+
+    alignas(16) float ts[4], us[4], vs[4];
+    _mm_store_ps(ts, t);
+    _mm_store_ps(us, u);
+    _mm_store_ps(vs, v);
+    int best = -1;
+    for (int lane = 0; lane < 4; ++lane) {
+        if ((lanes & (1 << lane)) && (best == -1 || ts[lane] < ts[best])) {
+            best = lane;
+        }
+    }
+    hit.distance = ts[best];
+    hit.u = us[best];
+    hit.v = vs[best];
+    hit.triangle = block.triangle[best];
+    return true;
+#else
+    bool found = false;
+    for (int lane = 0; lane < 4; ++lane) {
+        glm::vec3 edge1(block.edge1[0][lane], block.edge1[1][lane], block.edge1[2][lane]);
+        glm::vec3 edge2(block.edge2[0][lane], block.edge2[1][lane], block.edge2[2][lane]);
+        glm::vec3 p = glm::cross(ray.direction, edge2);
+        float det = glm::dot(edge1, p);
+        if (det == 0.0f) {
+            continue;
+        }
+        float inverse_det = 1.0f / det;
+        glm::vec3 s = ray.origin - glm::vec3(block.v0[0][lane], block.v0[1][lane], block.v0[2][lane]);
+        float u = glm::dot(s, p) * inverse_det;
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = glm::dot(ray.direction, q) * inverse_det;
+        float t = glm::dot(edge2, q) * inverse_det;
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < hit.distance) {
+            hit.distance = t;
+            hit.u = u;
+            hit.v = v;
+            hit.triangle = block.triangle[lane];
+            found = true;
+        }
+    }
+    return found;
+#endif
+}
+}
+
+void Bvh::build(const std::vector<Vertex>& vertices, const std::vector<glm::uvec3>& indices)
+{
+    auto start = std::chrono::steady_clock::now();
+    nodes.clear();
+    blocks.clear();
+    if (indices.empty()) {
+        return;
+    }
+
+    std::vector<BuildTriangle> triangles(indices.size());
+    parallel_for(indices.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            BuildTriangle& triangle = triangles[i];
+            for (int corner = 0; corner < 3; ++corner) {
+                triangle.bounds.extend(vertices[indices[i][corner]].pos);
+            }
+            triangle.centroid = (triangle.bounds.min + triangle.bounds.max) * 0.5f;
+            triangle.index = i;
+        }
+    });
+
+    // Enough levels of the tree on their own threads to keep every core busy
+    unsigned parallel_depth = 0;
+    while ((1u << parallel_depth) < std::thread::hardware_concurrency()) {
+        parallel_depth++;
+    }
+
+    nodes.reserve(2 * indices.size() / MAX_LEAF_SIZE);
+    build_node(triangles, 0, indices.size(), nodes, 0, parallel_depth);
+
+    std::vector<uint32_t> leaves;
+    for (uint32_t i = 0; i < nodes.size(); ++i) {
+        if (nodes[i].count > 0) {
+            leaves.push_back(i);
+        }
+    }
+
+    // Replace the leaves' triangle ranges with blocks of their triangles
+    blocks.resize(leaves.size());
+    parallel_for(leaves.size(), [&](size_t begin, size_t end) {
+        for (size_t leaf = begin; leaf < end; ++leaf) {
+            BvhNode& node = nodes[leaves[leaf]];
+            BvhTriangleBlock& block = blocks[leaf];
+            for (uint32_t lane = 0; lane < 4; ++lane) {
+                glm::vec3 v0(0.0f), edge1(0.0f), edge2(0.0f);
+                block.triangle[lane] = std::numeric_limits<uint32_t>::max();
+                if (lane < node.count) {
+                    uint32_t triangle = triangles[node.first + lane].index;
+                    const glm::uvec3& face = indices[triangle];
+                    v0 = vertices[face[0]].pos;
+                    edge1 = vertices[face[1]].pos - v0;
+                    edge2 = vertices[face[2]].pos - v0;
+                    block.triangle[lane] = triangle;
+                }
+                for (int axis = 0; axis < 3; ++axis) {
+                    block.v0[axis][lane] = v0[axis];
+                    block.edge1[axis][lane] = edge1[axis];
+                    block.edge2[axis][lane] = edge2[axis];
+                }
+            }
+            node.first = leaf;
+        }
+    },
+        256);
+
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    spdlog::info("Built BVH over {} triangles: {} nodes, {} leaves in {:.1f} ms", indices.size(), nodes.size(), leaves.size(), elapsed.count());
+}
+
+std::optional<RayHit> Bvh::intersect(const Ray& ray, float max_distance) const
+{
+    if (nodes.empty()) {
+        return {};
+    }
+
+    float inverse_direction[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        inverse_direction[axis] = 1.0f / ray.direction[axis];
+    }
+
+    RayHit hit;
+    hit.distance = max_distance;
+    bool found = false;
+
+    // Nodes still to visit, with the distance at which the ray enters them
+    struct StackEntry {
+        uint32_t node;
+        float distance;
+    };
+    StackEntry stack[STACK_SIZE];
+    size_t stack_size = 0;
+
+    if (enter_node(nodes[0], ray, inverse_direction, hit.distance) == std::numeric_limits<float>::infinity()) {
+        return {};
+    }
+    uint32_t current = 0;
+    while (true) {
+        const BvhNode& node = nodes[current];
+        if (node.count > 0) {
+            found |= intersect_block(blocks[node.first], ray, hit);
+        } else {
+            // Visit the nearer child first so that hits in it cull the other
+            StackEntry near { current + 1, enter_node(nodes[current + 1], ray, inverse_direction, hit.distance) };
+            StackEntry far { node.first, enter_node(nodes[node.first], ray, inverse_direction, hit.distance) };
+            if (far.distance < near.distance) {
+                std::swap(near, far);
+            }
+            if (near.distance != std::numeric_limits<float>::infinity()) {
+                if (far.distance != std::numeric_limits<float>::infinity()) {
+                    stack[stack_size++] = far;
+                }
+                current = near.node;
+                continue;
+            }
+        }
+
+        // Skip nodes the ray only enters beyond the closest hit so far
+        bool next = false;
+        while (stack_size > 0 && !next) {
+            StackEntry entry = stack[--stack_size];
+            if (entry.distance < hit.distance) {
+                current = entry.node;
+                next = true;
+            }
+        }
+        if (!next) {
+            break;
+        }
+    }
+
+    if (!found) {
+        return {};
+    }
+    hit.position = ray.origin + ray.direction * hit.distance;
+    return hit;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "vertex.h"
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+struct RayHit {
+    float distance; // along the ray, in units of its direction
+    uint32_t triangle; // index into the mesh's indices
+    float u, v; // barycentric coordinates of the hit on the triangle
+    glm::vec3 position;
+};
+
+// Flattened in depth first order, so an interior node's first child is the
+// node right after it.
+struct BvhNode {
+    float bounds_min[3];
+    uint32_t first; // leaf: index of its triangle block, interior: index of the second child
+    float bounds_max[3];
+    uint32_t count; // triangles in a leaf, 0 for interior nodes
+};
+static_assert(sizeof(BvhNode) == 32, "BvhNode should stay half a cache line");
+
+// The up to 4 triangles of a leaf laid out for intersecting them all at once,
+// one lane per triangle. Unused lanes are degenerate and never hit.
+struct alignas(16) BvhTriangleBlock {
+    float v0[3][4];
+    float edge1[3][4]; // v1 - v0
+    float edge2[3][4]; // v2 - v0
+    uint32_t triangle[4];
+};
+
+// Bounding volume hierarchy over the triangles of a mesh, for ray queries such
+// as picking. Built with the surface area heuristic, the top levels of the
+// tree are split across threads.
+class Bvh {
+public:
+    Bvh() = default;
+
+    void build(const std::vector<Vertex>& vertices, const std::vector<glm::uvec3>& indices);
+
+    // Closest triangle hit by ray, either side of a triangle counts
+    std::optional<RayHit> intersect(const Ray& ray, float max_distance = std::numeric_limits<float>::infinity()) const;
+
+    size_t node_count() const { return nodes.size(); }
+
+private:
+    std::vector<BvhNode> nodes;
+    std::vector<BvhTriangleBlock> blocks;
+};
@@ -0,0 +1,33 @@
+#include "counting_resource.h"
+
+CountingResource::CountingResource(std::pmr::memory_resource* upstream)
+    : upstream(upstream)
+{
+}
+
+void* CountingResource::do_allocate(size_t bytes, size_t alignment)
+{
+    void* p = upstream->allocate(bytes, alignment);
+
+    allocations++;
+    total += bytes;
+    current += bytes;
+    if (current > peak) {
+        peak = current;
+    }
+
+    return p;
+}
+
+void CountingResource::do_deallocate(void* p, size_t bytes, size_t alignment)
+{
+    upstream->deallocate(p, bytes, alignment);
+
+    deallocations++;
+    current -= bytes;
+}
+
+bool CountingResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+    return this == &other;
+}
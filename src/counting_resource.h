@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+// Forwards every request to an upstream resource while keeping statistics
+// about it, so that allocation heavy code paths can be checked.
+class CountingResource : public std::pmr::memory_resource {
+public:
+    explicit CountingResource(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource());
+
+    CountingResource(const CountingResource&) = delete;
+    CountingResource& operator=(const CountingResource&) = delete;
+
+    size_t allocation_count() const { return allocations; }
+    size_t deallocation_count() const { return deallocations; }
+    size_t total_bytes() const { return total; }
+    size_t current_bytes() const { return current; }
+    size_t peak_bytes() const { return peak; }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+    std::pmr::memory_resource* upstream;
+
+    size_t allocations = 0;
+    size_t deallocations = 0;
+    size_t total = 0;
+    size_t current = 0;
+    size_t peak = 0;
+};
@@ -0,0 +1,80 @@
+#include "frame_log.h"
+
+#include <sstream>
+#include <string>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+namespace {
+constexpr const char* FRAME_LOG_HEADER = "# simple_render frame log v1";
+}
+
+FrameRecorder::FrameRecorder(const std::string& filename)
+    : file(filename)
+{
+    if (!file) {
+        spdlog::error("Could not open \"{}\" for recording", filename);
+        return;
+    }
+    file << FRAME_LOG_HEADER << '\n';
+    file << "# time width height debug_mode camera_position camera_target camera_up\n";
+}
+
+void FrameRecorder::record(const FrameInputs& inputs)
+{
+    if (!file) {
+        return;
+    }
+    // Enough digits to read back the exact same floats
+    file << fmt::format("{:.17g} {} {} {} {:.9g} {:.9g} {:.9g} {:.9g} {:.9g} {:.9g} {:.9g} {:.9g} {:.9g}\n",
+        inputs.time, inputs.width, inputs.height, inputs.debug_mode ? 1 : 0,
+        inputs.camera_position.x, inputs.camera_position.y, inputs.camera_position.z,
+        inputs.camera_target.x, inputs.camera_target.y, inputs.camera_target.z,
+        inputs.camera_up.x, inputs.camera_up.y, inputs.camera_up.z);
+}
+
+std::optional<std::vector<FrameInputs>> read_frame_log(const std::string& filename)
+{
+    std::ifstream file(filename);
+    if (!file) {
+        spdlog::error("Could not open \"{}\"", filename);
+        return {};
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != FRAME_LOG_HEADER) {
+        spdlog::error("\"{}\" is not a frame log", filename);
+        return {};
+    }
+
+    std::vector<FrameInputs> frames;
+    size_t line_number = 1;
+    while (std::getline(file, line)) {
+        line_number++;
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::stringstream stream(line);
+        FrameInputs inputs;
+        int debug_mode;
+        stream >> inputs.time >> inputs.width >> inputs.height >> debug_mode
+            >> inputs.camera_position.x >> inputs.camera_position.y >> inputs.camera_position.z
+            >> inputs.camera_target.x >> inputs.camera_target.y >> inputs.camera_target.z
+            >> inputs.camera_up.x >> inputs.camera_up.y >> inputs.camera_up.z;
+        if (!stream) {
+            spdlog::error("Invalid frame on line {} of \"{}\"", line_number, filename);
+            return {};
+        }
+        inputs.debug_mode = debug_mode != 0;
+        // Older logs recorded frames while the window was minimized
+        if (inputs.width <= 0 || inputs.height <= 0) {
+            spdlog::warn("Skipping frame of size {}x{} on line {} of \"{}\"", inputs.width, inputs.height, line_number, filename);
+            continue;
+        }
+        frames.push_back(inputs);
+    }
+
+    spdlog::info("Read {} frames from \"{}\"", frames.size(), filename);
+    return frames;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Everything the render loop takes from the outside world for one frame.
+// Replaying a list of these reproduces the frames that were recorded.
+struct FrameInputs {
+    double time = 0.0;
+    int width = 0;
+    int height = 0;
+    bool debug_mode = false;
+
+    glm::vec3 camera_position = glm::vec3(0.f);
+    glm::vec3 camera_target = glm::vec3(0.f);
+    glm::vec3 camera_up = glm::vec3(0.f, 1.f, 0.f);
+};
+
+// Appends one line per frame to a text log that read_frame_log can load
+class FrameRecorder {
+public:
+    explicit FrameRecorder(const std::string& filename);
+
+    bool is_open() const { return static_cast<bool>(file); }
+
+    void record(const FrameInputs& inputs);
+
+private:
+    std::ofstream file;
+};
+
+std::optional<std::vector<FrameInputs>> read_frame_log(const std::string& filename);
@@ -0,0 +1,91 @@
+#include "frame_timer.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+FrameTimer::~FrameTimer()
+{
+    if (!queries.empty()) {
+        glDeleteQueries(queries.size(), queries.data());
+    }
+}
+
+void FrameTimer::begin_frame()
+{
+    frame_start = std::chrono::steady_clock::now();
+
+    GLuint query;
+    glGenQueries(1, &query);
+    queries.push_back(query);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+void FrameTimer::end_gpu_work()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+}
+
+void FrameTimer::end_frame()
+{
+    auto elapsed = std::chrono::steady_clock::now() - frame_start;
+    cpu_ms.push_back(std::chrono::duration<double, std::milli>(elapsed).count());
+}
+
+void FrameTimer::record_state_calls(size_t issued, size_t saved)
+{
+    calls_issued.push_back(issued);
+    calls_saved.push_back(saved);
+}
+
+void FrameTimer::write_report(const std::string& filename)
+{
+    size_t frames = std::min(queries.size(), cpu_ms.size());
+    if (frames == 0) {
+        return;
+    }
+
+    std::vector<double> gpu_ms(frames);
+    for (size_t i = 0; i < frames; ++i) {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns);
+        gpu_ms[i] = ns / 1.0e6;
+    }
+
+    if (!filename.empty()) {
+        std::ofstream file(filename);
+        if (!file) {
+            spdlog::error("Could not open \"{}\" for the timing report", filename);
+        } else {
+            file << "frame,cpu_ms,gpu_ms,gl_calls_issued,gl_calls_saved\n";
+            for (size_t i = 0; i < frames; ++i) {
+                size_t issued = i < calls_issued.size() ? calls_issued[i] : 0;
+                size_t saved = i < calls_saved.size() ? calls_saved[i] : 0;
+                file << fmt::format("{},{:.4f},{:.4f},{},{}\n", i, cpu_ms[i], gpu_ms[i], issued, saved);
+            }
+        }
+    }
+
+    auto summarize = [frames](const char* name, const std::vector<double>& ms) {
+        double total = 0.0;
+        for (size_t i = 0; i < frames; ++i) {
+            total += ms[i];
+        }
+        auto [min, max] = std::minmax_element(ms.begin(), ms.begin() + frames);
+        fmt::print("{} frame time over {} frames: avg {:.4f} ms, min {:.4f} ms, max {:.4f} ms\n", name, frames, total / frames, *min, *max);
+    };
+    summarize("CPU", cpu_ms);
+    summarize("GPU", gpu_ms);
+
+    if (!calls_saved.empty()) {
+        size_t total_issued = 0;
+        size_t total_saved = 0;
+        for (size_t i = 0; i < calls_saved.size(); ++i) {
+            total_issued += calls_issued[i];
+            total_saved += calls_saved[i];
+        }
+        fmt::print("GL state and draw calls per frame: {:.1f} issued, {:.1f} saved\n", total_issued / double(calls_saved.size()), total_saved / double(calls_saved.size()));
+    }
+}
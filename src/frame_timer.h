@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <epoxy/gl.h>
+
+// Measures the CPU and GPU time of every frame. GPU times come from timer
+// queries that are only read back in write_report, so measuring never stalls
+// the pipeline.
+class FrameTimer {
+public:
+    FrameTimer() = default;
+    ~FrameTimer();
+
+    FrameTimer(const FrameTimer&) = delete;
+    FrameTimer& operator=(const FrameTimer&) = delete;
+
+    void begin_frame();
+    void end_gpu_work(); // after the last draw call of the frame
+    void end_frame(); // after the buffer swap
+    // GL state changes and draws made and avoided by the render state cache
+    void record_state_calls(size_t issued, size_t saved);
+
+    // Prints a summary, and writes one csv line per frame if filename is not empty
+    void write_report(const std::string& filename);
+
+private:
+    std::chrono::steady_clock::time_point frame_start;
+    std::vector<GLuint> queries;
+    std::vector<double> cpu_ms;
+    std::vector<size_t> calls_issued;
+    std::vector<size_t> calls_saved;
+};
@@ -0,0 +1,343 @@
+#include "json.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+#include <spdlog/spdlog.h>
+
+class JsonValue::Parser {
+public:
+    explicit Parser(std::string_view text)
+        : text(text)
+    {
+    }
+
+    bool parse_document(JsonValue& out)
+    {
+        if (!parse_value(out, 0)) {
+            return false;
+        }
+        skip_whitespace();
+        if (pos != text.size()) {
+            return fail("trailing characters");
+        }
+        return true;
+    }
+
+private:
+    // Guards against stack exhaustion on malicious input
+    static constexpr int MAX_DEPTH = 128;
+
+    bool fail(const char* what)
+    {
+        spdlog::error("JSON parse error at offset {}: {}", pos, what);
+        return false;
+    }
+
+    void skip_whitespace()
+    {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) {
+            ++pos;
+        }
+    }
+
+    bool consume(char c)
+    {
+        skip_whitespace();
+        if (pos < text.size() && text[pos] == c) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    bool consume_literal(std::string_view literal)
+    {
+        if (text.substr(pos, literal.size()) == literal) {
+            pos += literal.size();
+            return true;
+        }
+        return false;
+    }
+
+    bool parse_value(JsonValue& out, int depth)
+    {
+        if (depth > MAX_DEPTH) {
+            return fail("nesting too deep");
+        }
+
+        skip_whitespace();
+        if (pos >= text.size()) {
+            return fail("unexpected end of input");
+        }
+
+        char c = text[pos];
+        if (c == '{') {
+            return parse_object(out, depth);
+        } else if (c == '[') {
+            return parse_array(out, depth);
+        } else if (c == '"') {
+            out.value_type = Type::String;
+            return parse_string(out.string);
+        } else if (consume_literal("true")) {
+            out.value_type = Type::Bool;
+            out.boolean = true;
+            return true;
+        } else if (consume_literal("false")) {
+            out.value_type = Type::Bool;
+            out.boolean = false;
+            return true;
+        } else if (consume_literal("null")) {
+            out.value_type = Type::Null;
+            return true;
+        }
+        return parse_number(out);
+    }
+
+    bool parse_object(JsonValue& out, int depth)
+    {
+        out.value_type = Type::Object;
+        ++pos; // '{'
+        if (consume('}')) {
+            return true;
+        }
+        do {
+            skip_whitespace();
+            std::string key;
+            if (pos >= text.size() || text[pos] != '"' || !parse_string(key)) {
+                return fail("expected object key");
+            }
+            if (!consume(':')) {
+                return fail("expected ':'");
+            }
+            JsonValue value;
+            if (!parse_value(value, depth + 1)) {
+                return false;
+            }
+            out.keys.push_back(std::move(key));
+            out.elements.push_back(std::move(value));
+        } while (consume(','));
+
+        if (!consume('}')) {
+            return fail("expected '}'");
+        }
+        return true;
+    }
+
+    bool parse_array(JsonValue& out, int depth)
+    {
+        out.value_type = Type::Array;
+        ++pos; // '['
+        if (consume(']')) {
+            return true;
+        }
+        do {
+            JsonValue value;
+            if (!parse_value(value, depth + 1)) {
+                return false;
+            }
+            out.elements.push_back(std::move(value));
+        } while (consume(','));
+
+        if (!consume(']')) {
+            return fail("expected ']'");
+        }
+        return true;
+    }
+
+    static void append_utf8(std::string& out, unsigned long code_point)
+    {
+        if (code_point < 0x80) {
+            out.push_back(static_cast<char>(code_point));
+        } else if (code_point < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+            out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        } else if (code_point < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        }
+    }
+
+    bool parse_hex4(unsigned long& out)
+    {
+        if (pos + 4 > text.size()) {
+            return fail("truncated unicode escape");
+        }
+        std::string digits(text.substr(pos, 4));
+        char* end;
+        out = std::strtoul(digits.c_str(), &end, 16);
+        if (end != digits.c_str() + 4) {
+            return fail("invalid unicode escape");
+        }
+        pos += 4;
+        return true;
+    }
+
+    bool parse_string(std::string& out)
+    {
+        ++pos; // opening quote
+        while (pos < text.size()) {
+            char c = text[pos++];
+            if (c == '"') {
+                return true;
+            }
+            if (c != '\\') {
+                out.push_back(c);
+                continue;
+            }
+            if (pos >= text.size()) {
+                break;
+            }
+            char escape = text[pos++];
+            switch (escape) {
+            case '"':
+            case '\\':
+            case '/':
+                out.push_back(escape);
+                break;
+            case 'b':
+                out.push_back('\b');
+                break;
+            case 'f':
+                out.push_back('\f');
+                break;
+            case 'n':
+                out.push_back('\n');
+                break;
+            case 'r':
+                out.push_back('\r');
+                break;
+            case 't':
+                out.push_back('\t');
+                break;
+            case 'u': {
+                unsigned long code_point;
+                if (!parse_hex4(code_point)) {
+                    return false;
+                }
+                // Combine UTF-16 surrogate pairs
+                if (code_point >= 0xD800 && code_point < 0xDC00 && consume_literal("\\u")) {
+                    unsigned long low;
+                    if (!parse_hex4(low)) {
+                        return false;
+                    }
+                    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                }
+                append_utf8(out, code_point);
+                break;
+            }
+            default:
+                return fail("invalid escape");
+            }
+        }
+        return fail("unterminated string");
+    }
+
+    bool parse_number(JsonValue& out)
+    {
+        size_t start = pos;
+        while (pos < text.size()) {
+            char c = text[pos];
+            if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') {
+                ++pos;
+            } else {
+                break;
+            }
+        }
+        if (start == pos) {
+            return fail("unexpected character");
+        }
+
+        std::string digits(text.substr(start, pos - start));
+        char* end;
+        out.value_type = Type::Number;
+        out.number = std::strtod(digits.c_str(), &end);
+        if (end != digits.c_str() + digits.size()) {
+            return fail("invalid number");
+        }
+        return true;
+    }
+
+    std::string_view text;
+    size_t pos = 0;
+};
+
+std::optional<JsonValue> JsonValue::parse(std::string_view text)
+{
+    JsonValue value;
+    Parser parser(text);
+    if (!parser.parse_document(value)) {
+        return {};
+    }
+    return value;
+}
+
+const JsonValue* JsonValue::find(std::string_view key) const
+{
+    if (value_type != Type::Object) {
+        return nullptr;
+    }
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (keys[i] == key) {
+            return &elements[i];
+        }
+    }
+    return nullptr;
+}
+
+const JsonValue* JsonValue::at(size_t index) const
+{
+    if (value_type != Type::Array || index >= elements.size()) {
+        return nullptr;
+    }
+    return &elements[index];
+}
+
+size_t JsonValue::size() const
+{
+    return elements.size();
+}
+
+std::optional<size_t> JsonValue::as_unsigned() const
+{
+    // Integers above 2^53 are no longer exact, and their cast could overflow
+    constexpr double MAX_EXACT = 9007199254740992.0;
+    if (!is_number() || !(number >= 0.0) || number > MAX_EXACT || std::floor(number) != number) {
+        return {};
+    }
+    return static_cast<size_t>(number);
+}
+
+double JsonValue::number_or(std::string_view key, double fallback) const
+{
+    auto value = find(key);
+    if (!value || !value->is_number()) {
+        return fallback;
+    }
+    return value->as_number();
+}
+
+std::optional<size_t> JsonValue::unsigned_or(std::string_view key, size_t fallback) const
+{
+    auto value = find(key);
+    if (!value) {
+        return fallback;
+    }
+    return value->as_unsigned();
+}
+
+std::string JsonValue::string_or(std::string_view key, const std::string& fallback) const
+{
+    auto value = find(key);
+    if (!value || !value->is_string()) {
+        return fallback;
+    }
+    return value->as_string();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Minimal read-only JSON document, enough to walk the header of a glTF file
+class JsonValue {
+public:
+    enum class Type {
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object
+    };
+
+    JsonValue() = default;
+
+    JsonValue(const JsonValue&) = default;
+    JsonValue& operator=(const JsonValue&) = default;
+
+    JsonValue(JsonValue&&) = default;
+    JsonValue& operator=(JsonValue&&) = default;
+
+    static std::optional<JsonValue> parse(std::string_view text);
+
+    Type type() const { return value_type; }
+    bool is_object() const { return value_type == Type::Object; }
+    bool is_array() const { return value_type == Type::Array; }
+    bool is_number() const { return value_type == Type::Number; }
+    bool is_string() const { return value_type == Type::String; }
+
+    // Returns nullptr if this is not an object or has no such member
+    const JsonValue* find(std::string_view key) const;
+    // Returns nullptr if this is not an array or index is out of range
+    const JsonValue* at(size_t index) const;
+    // Number of elements of an array or members of an object
+    size_t size() const;
+
+    bool as_bool() const { return boolean; }
+    double as_number() const { return number; }
+    const std::string& as_string() const { return string; }
+    // The number as a count, size or index: empty unless it is a non-negative
+    // integer that a double represents exactly
+    std::optional<size_t> as_unsigned() const;
+
+    // Convenience accessors for optional members of an object
+    double number_or(std::string_view key, double fallback) const;
+    // fallback if the member is missing, empty if it is not a valid as_unsigned
+    std::optional<size_t> unsigned_or(std::string_view key, size_t fallback) const;
+    std::string string_or(std::string_view key, const std::string& fallback) const;
+
+private:
+    class Parser;
+
+    Type value_type = Type::Null;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<JsonValue> elements;
+    std::vector<std::string> keys; // parallel to elements for objects
+};
@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
+#include <iterator>
 #include <optional>
 #include <string>
 #include <vector>
@@ -17,9 +21,16 @@
 
 #include <spdlog/async.h>
 
+#include "batch_renderer.h"
+#include "bvh.h"
 #include "debug_callback.h"
+#include "frame_log.h"
+#include "frame_timer.h"
 #include "mesh.h"
+#include "render_state.h"
+#include "render_target.h"
 #include "shader.h"
+#include "texture.h"
 #include "utils.h"
 
 void error_callback(int error, const char* des)
@@ -41,11 +52,54 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
     }
 }
 
+// Cursor position of the last click, picked once the frame is done
+std::optional<std::pair<double, double>> pick_cursor;
+
+static void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+    (void)mods;
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
+        double x, y;
+        glfwGetCursorPos(window, &x, &y);
+        pick_cursor = std::make_pair(x, y);
+    }
+}
+
+// Ray through a point of the window, in the space that mvp transforms from
+static Ray cursor_ray(GLFWwindow* window, double x, double y, const glm::mat4& mvp)
+{
+    int window_width, window_height;
+    glfwGetWindowSize(window, &window_width, &window_height);
+    // Window coordinates start at the top left, normalized device coordinates at the bottom left
+    float ndc_x = 2.0f * x / window_width - 1.0f;
+    float ndc_y = 1.0f - 2.0f * y / window_height;
+
+    glm::mat4 inverse_mvp = glm::inverse(mvp);
+    glm::vec4 near_point = inverse_mvp * glm::vec4(ndc_x, ndc_y, -1.0f, 1.0f);
+    glm::vec4 far_point = inverse_mvp * glm::vec4(ndc_x, ndc_y, 1.0f, 1.0f);
+
+    Ray ray;
+    ray.origin = glm::vec3(near_point) / near_point.w;
+    ray.direction = glm::normalize(glm::vec3(far_point) / far_point.w - ray.origin);
+    return ray;
+}
+
 void print_usage(std::string name)
 {
-    fmt::print("Usage: {} [-v[v...]] [mesh]", name);
+    fmt::print("Usage: {} [-v[v...]] [--record log | --replay log [--timing csv]] [--texture ktx] [mesh]", name);
+    fmt::print("       {} [-v[v...]] --turntable count | --poses file [--view-size WxH] [--threads count] [--output dir] [mesh]", name);
     fmt::print("\tmultiple v's can be used in -v to increase verbosity, e.g. -vvv");
+    fmt::print("\t--record writes the inputs of every frame to log");
+    fmt::print("\t--replay renders the frames in log instead of reading the window and clock, and reports frame times");
+    fmt::print("\t--timing writes the per frame times of a replay to csv");
+    fmt::print("\t--texture streams a KTX texture (BC, ETC2 or uncompressed) onto the mesh using its uvs");
+    fmt::print("\t--turntable renders count views around the mesh offscreen instead of opening a window, and reports views per second");
+    fmt::print("\t--poses does the same for the camera poses in file, one \"position target up\" line of 9 numbers per view");
+    fmt::print("\t--view-size sets the size of every view, 512x512 by default");
+    fmt::print("\t--threads sets the number of render threads, each with its own GL context, 2 by default");
+    fmt::print("\t--output writes every view to dir as a .ppm image");
     fmt::print("\tIf no mesh is given, test.obj is used");
+    fmt::print("\tMeshes can be .obj, binary glTF (.glb) or binary .ply files");
 }
 
 int main(int argc, char** argv)
@@ -53,8 +107,36 @@ int main(int argc, char** argv)
     std::string mesh_file = "test.obj";
     bool mesh_file_given = false;
     int verbosity = 0;
+    std::string record_file;
+    std::string replay_file;
+    std::string timing_file;
+    std::string texture_file;
+    std::string turntable_count;
+    std::string poses_file;
+    std::string view_size;
+    std::string thread_count;
+    std::string output_dir;
+    const std::pair<const char*, std::string*> value_options[] = {
+        { "--record", &record_file },
+        { "--replay", &replay_file },
+        { "--timing", &timing_file },
+        { "--texture", &texture_file },
+        { "--turntable", &turntable_count },
+        { "--poses", &poses_file },
+        { "--view-size", &view_size },
+        { "--threads", &thread_count },
+        { "--output", &output_dir },
+    };
     for (int i = 1; i < argc; ++i) {
-        if (argv[i][0] == '-') {
+        std::string arg(argv[i]);
+        auto option = std::find_if(std::begin(value_options), std::end(value_options), [&arg](const auto& o) { return arg == o.first; });
+        if (option != std::end(value_options)) {
+            if (i + 1 >= argc) {
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            *option->second = argv[++i];
+        } else if (argv[i][0] == '-') {
             std::string vs(argv[i] + 1);
             for (auto c : vs) {
                 if (c == 'v') {
@@ -104,22 +186,74 @@ int main(int argc, char** argv)
         spdlog::set_default_logger(logger);
     }
 
+    // Faces meeting at more than this angle keep a hard edge when normals are generated
+    constexpr float CREASE_ANGLE = 60.0f;
+
+    if (!record_file.empty() && !replay_file.empty()) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    bool batch = !turntable_count.empty() || !poses_file.empty();
+    BatchOptions batch_options;
+    int turntable_views = 0;
+    if (batch) {
+        int threads = batch_options.thread_count;
+        if ((!turntable_count.empty() && !poses_file.empty())
+            || (!turntable_count.empty() && (std::sscanf(turntable_count.c_str(), "%d", &turntable_views) != 1 || turntable_views <= 0))
+            || (!view_size.empty() && std::sscanf(view_size.c_str(), "%dx%d", &batch_options.view_width, &batch_options.view_height) != 2)
+            || (!thread_count.empty() && (std::sscanf(thread_count.c_str(), "%d", &threads) != 1 || threads <= 0))) {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        batch_options.thread_count = threads;
+        batch_options.output_dir = output_dir;
+    }
+
+    std::vector<FrameInputs> replay_frames;
+    bool replaying = !replay_file.empty();
+    if (replaying) {
+        auto frames_opt = read_frame_log(replay_file);
+        if (!frames_opt) {
+            return EXIT_FAILURE;
+        }
+        replay_frames = std::move(*frames_opt);
+    }
+
+    std::optional<FrameRecorder> recorder;
+    if (!record_file.empty()) {
+        recorder.emplace(record_file);
+        if (!recorder->is_open()) {
+            return EXIT_FAILURE;
+        }
+    }
+
     Mesh my_mesh;
-    my_mesh.loadObj(mesh_file);
+    my_mesh.load(mesh_file);
+    my_mesh.generateNormals(CREASE_ANGLE);
+
+    // Clicking on the mesh picks the triangle under the cursor
+    Bvh bvh;
+    if (!batch) {
+        bvh.build(my_mesh.getVertices(), my_mesh.getIndices());
+    }
 
     if (!glfwInit()) {
         spdlog::error("Could not load glfw!");
         return EXIT_FAILURE;
     }
 
-    std::vector<Vertex> vertices = my_mesh.getVertices();
-    std::vector<glm::uvec3> indices = my_mesh.getIndices();
+    const std::vector<Vertex>& vertices = my_mesh.getVertices();
+    const std::vector<glm::uvec3>& indices = my_mesh.getIndices();
+    const std::vector<MeshPart>& mesh_parts = my_mesh.getParts();
 
     glfwSetErrorCallback(error_callback);
 
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+    // Batch mode renders offscreen, the window only provides the context the workers share
+    glfwWindowHint(GLFW_VISIBLE, batch ? GLFW_FALSE : GLFW_TRUE);
     GLFWwindow* window = glfwCreateWindow(1920, 1080, "OpenGL Test", NULL, NULL);
     if (!window) {
         spdlog::error("Could not create window!");
@@ -127,11 +261,14 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
+    int exit_code = 0;
     // Scope to prevent openGL objects from being destructed after GLFW is terminated
     {
         glfwMakeContextCurrent(window);
         glfwSetKeyCallback(window, key_callback);
-        glfwSwapInterval(1);
+        glfwSetMouseButtonCallback(window, mouse_button_callback);
+        // Replays run as fast as possible so that the frame times mean something
+        glfwSwapInterval(replaying ? 0 : 1);
 
         spdlog::info("OpenGL Version: {}", epoxy_gl_version());
         glDebugMessageCallback(debug_callback, nullptr);
@@ -225,15 +362,27 @@ int main(int argc, char** argv)
             glVertexAttribPointer(vpos_location, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
         }
 
+        // Textures stream in over the first frames, the mesh is drawn untextured until then
+        constexpr size_t TEXTURE_VRAM_BUDGET = 256 * 1024 * 1024;
+        constexpr size_t TEXTURE_UPLOAD_BUDGET = 4 * 1024 * 1024; // per frame
+        TextureStreamer texture_streamer(TEXTURE_VRAM_BUDGET, TEXTURE_UPLOAD_BUDGET);
+        std::optional<size_t> diffuse_texture;
+        if (!texture_file.empty()) {
+            diffuse_texture = texture_streamer.request(texture_file);
+        }
+        // Streaming progress depends on thread timing, replays need every
+        // frame to sample the same levels
+        if (replaying) {
+            texture_streamer.finish();
+        }
+
         glClearColor(0.0, 0.0, 0.0, 1.0);
 
         glm::mat4 m, p, mvp;
         // Position the camera at (40, 30, 30) looking towards (0, 0, 0), with (0, 1, 0) up vector
-        glm::mat4 view = glm::lookAt(
-            glm::vec3(40.f, 30.f, 30.f), // Camera position
-            glm::vec3(0.f), // looking at
-            glm::vec3(0.f, 1.f, 0.f) // Up vector
-        );
+        glm::vec3 camera_position = glm::vec3(40.f, 30.f, 30.f);
+        glm::vec3 camera_target = glm::vec3(0.f);
+        glm::vec3 camera_up = glm::vec3(0.f, 1.f, 0.f);
 
         // light pos is 20 units higher than camera
         glm::vec3 light_position = glm::vec3(40.f, 40.f, 30.f);
@@ -261,14 +410,90 @@ int main(int argc, char** argv)
         float scale = 10.f / max_len;
         spdlog::info("scaling factor: {}", scale);
 
+        bool batch_failed = false;
+        if (batch) {
+            std::optional<std::vector<CameraPose>> poses;
+            if (poses_file.empty()) {
+                // Circle the mesh at the distance and height of the interactive camera
+                poses = turntable_poses(turntable_views, std::hypot(camera_position.x, camera_position.z), camera_position.y);
+            } else {
+                poses = read_camera_poses(poses_file);
+            }
+            batch_failed = !poses || !render_batch(window, vertex_buffer, index_buffer, indices.size() * 3, scale, *poses, batch_options);
+            // Skips the interactive loop
+            glfwSetWindowShouldClose(window, GLFW_TRUE);
+        }
+
         glEnable(GL_DEPTH_TEST);
 
+        FrameTimer timer;
+        RenderStateCache render_state;
+        // The lighting and material never change while running
+        render_state.use_program(basic_shader.id());
+        basic_shader.set_uniform_vec3("light_position", light_position);
+        basic_shader.set_uniform_float("ambient_coefficient", ambient_coefficient);
+        basic_shader.set_uniform_float("diffuse_coefficient", diffuse_coefficient);
+        basic_shader.set_uniform_float("specular_coefficient", specular_coefficient);
+        basic_shader.set_uniform_float("shininess", shininess);
+        basic_shader.set_uniform_vec3("ambient_color", ambient_color);
+        basic_shader.set_uniform_vec3("diffuse_color", diffuse_color);
+        basic_shader.set_uniform_vec3("specular_color", specular_color);
+        basic_shader.set_uniform_int("diffuse_texture", 0);
+        RenderTarget replay_target;
+        DrawQueue draw_queue;
+        size_t frame_index = 0;
+        std::optional<glm::vec3> last_pick; // in mesh coordinates, for measuring between picks
+
         spdlog::trace("Start drawing");
         while (!glfwWindowShouldClose(window)) {
-            int width, height;
-            glfwGetFramebufferSize(window, &width, &height);
+            // Gather this frame's inputs, either live or from the replay log
+            FrameInputs inputs;
+            if (replaying) {
+                if (frame_index >= replay_frames.size()) {
+                    break;
+                }
+                inputs = replay_frames[frame_index];
+                debug_mode = inputs.debug_mode;
+            } else {
+                glfwGetFramebufferSize(window, &inputs.width, &inputs.height);
+                inputs.time = glfwGetTime();
+                inputs.debug_mode = debug_mode;
+                inputs.camera_position = camera_position;
+                inputs.camera_target = camera_target;
+                inputs.camera_up = camera_up;
+                // A minimized window has nothing to replay
+                if (recorder && inputs.width > 0 && inputs.height > 0) {
+                    recorder->record(inputs);
+                }
+            }
+            frame_index++;
+
+            if (replaying) {
+                timer.begin_frame();
+            }
+
+            int width = inputs.width;
+            int height = inputs.height;
             float ratio = width / (float)height;
-            float time = glfwGetTime();
+            float time = inputs.time;
+
+            glm::mat4 view = glm::lookAt(inputs.camera_position, inputs.camera_target, inputs.camera_up);
+
+            // Streaming binds textures behind the cache's back
+            if (texture_streamer.update()) {
+                render_state.invalidate_texture();
+            }
+
+            // Replays render offscreen at exactly the logged size, whatever
+            // size the window manager gives the window
+            if (replaying) {
+                if (!replay_target.resize(width, height)) {
+                    spdlog::error("Could not render frame {} of \"{}\" at its logged size of {}x{}", frame_index - 1, replay_file, width, height);
+                    exit_code = EXIT_FAILURE;
+                    break;
+                }
+                replay_target.bind();
+            }
 
             glViewport(0, 0, width, height);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -284,61 +509,103 @@ int main(int argc, char** argv)
 
             glm::mat4 inv_trans_model_view = glm::transpose(glm::inverse(model_view));
 
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-            basic_shader.use();
+            GLuint diffuse_texture_id = diffuse_texture ? texture_streamer.texture(*diffuse_texture) : 0;
 
-            // Transformations
+            // Uniforms shared by all draws of a program are set once per frame,
+            // so only draws that really differ need a set_uniforms callback
+            render_state.use_program(basic_shader.id());
             basic_shader.set_uniform_mat4("MVP", mvp);
             basic_shader.set_uniform_mat4("model_view", model_view);
             basic_shader.set_uniform_mat4("inv_trans_model_view", inv_trans_model_view);
+            basic_shader.set_uniform_int("use_texture", diffuse_texture_id != 0);
+
+            // Parts share all their state, so they end up in one multi-draw
+            for (const auto& part : mesh_parts) {
+                DrawCommand mesh_draw;
+                mesh_draw.program = basic_shader.id();
+                mesh_draw.vao = VAO;
+                mesh_draw.texture = diffuse_texture_id;
+                mesh_draw.polygon_mode = GL_FILL;
+                mesh_draw.first = part.first_face * 3;
+                mesh_draw.count = part.face_count * 3;
+                draw_queue.submit(std::move(mesh_draw));
+            }
 
-            // light position
-            basic_shader.set_uniform_vec3("light_position", light_position);
-
-            // coefficients
-            basic_shader.set_uniform_float("ambient_coefficient", ambient_coefficient);
-            basic_shader.set_uniform_float("diffuse_coefficient", diffuse_coefficient);
-            basic_shader.set_uniform_float("specular_coefficient", specular_coefficient);
-
-            basic_shader.set_uniform_float("shininess", shininess);
-
-            // colors
-            basic_shader.set_uniform_vec3("ambient_color", ambient_color);
-            basic_shader.set_uniform_vec3("diffuse_color", diffuse_color);
-            basic_shader.set_uniform_vec3("specular_color", specular_color);
-
-            glBindVertexArray(VAO);
-            glDrawElements(GL_TRIANGLES, indices.size() * 3, GL_UNSIGNED_INT, nullptr);
-
-            basic_shader.unuse();
             // Also draw normals
             if (debug_mode) {
-
-                glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-                debug_shader.use();
-                // Transformations
+                render_state.use_program(debug_shader.id());
                 debug_shader.set_uniform_mat4("MVP", mvp);
 
-                // mode
-                debug_shader.set_uniform_int("mode", 0);
+                DrawCommand wireframe_draw;
+                wireframe_draw.program = debug_shader.id();
+                wireframe_draw.vao = VAO;
+                wireframe_draw.polygon_mode = GL_LINE;
+                wireframe_draw.count = indices.size() * 3;
+                wireframe_draw.set_uniforms = [&debug_shader]() {
+                    debug_shader.set_uniform_int("mode", 0);
+                };
+                draw_queue.submit(std::move(wireframe_draw));
+
+                DrawCommand normals_draw;
+                normals_draw.program = debug_shader.id();
+                normals_draw.vao = debug_VAO;
+                normals_draw.polygon_mode = GL_LINE;
+                normals_draw.primitive = GL_LINES;
+                normals_draw.indexed = false;
+                normals_draw.count = debug_vertices.size();
+                normals_draw.set_uniforms = [&debug_shader]() {
+                    debug_shader.set_uniform_int("mode", 1);
+                };
+                draw_queue.submit(std::move(normals_draw));
+            }
+
+            render_state.reset_counters();
+            draw_queue.flush(render_state);
+            spdlog::trace("GL state and draw calls: {} issued, {} saved", render_state.calls_issued(), render_state.calls_saved());
 
-                glDrawElements(GL_TRIANGLES, indices.size() * 3, GL_UNSIGNED_INT, nullptr);
+            if (replaying) {
+                timer.end_gpu_work();
 
-                debug_shader.set_uniform_int("mode", 1);
-                glBindVertexArray(debug_VAO);
-                glDrawArrays(GL_LINES, 0, debug_vertices.size());
-                debug_shader.unuse();
+                int window_width, window_height;
+                glfwGetFramebufferSize(window, &window_width, &window_height);
+                replay_target.present(window_width, window_height);
             }
 
-            glBindVertexArray(0);
-
             glfwSwapBuffers(window);
+
+            if (replaying) {
+                timer.end_frame();
+                timer.record_state_calls(render_state.calls_issued(), render_state.calls_saved());
+            }
+
             glfwPollEvents();
+
+            // Picks with this frame's transformations, which is what was clicked on
+            if (pick_cursor) {
+                auto hit = bvh.intersect(cursor_ray(window, pick_cursor->first, pick_cursor->second, mvp));
+                if (hit) {
+                    fmt::print("Picked triangle {} at ({:.4f}, {:.4f}, {:.4f})\n", hit->triangle, hit->position.x, hit->position.y, hit->position.z);
+                    if (last_pick) {
+                        fmt::print("Distance to the previous pick: {:.4f}\n", glm::distance(*last_pick, hit->position));
+                    }
+                    last_pick = hit->position;
+                } else {
+                    spdlog::info("Nothing under the cursor to pick");
+                }
+                pick_cursor.reset();
+            }
+        }
+
+        if (replaying) {
+            timer.write_report(timing_file);
+        }
+        if (batch_failed) {
+            exit_code = EXIT_FAILURE;
         }
     }
 
     glfwDestroyWindow(window);
     glfwTerminate();
 
-    return 0;
+    return exit_code;
 }
@@ -1,79 +1,244 @@
 #include "mesh.h"
 
 #include <algorithm>
-#include <fstream>
-#include <sstream>
+#include <cctype>
+#include <cstdlib>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <spdlog/spdlog.h>
 
+#include "allocation_counter.h"
+#include "counting_resource.h"
+#include "utils.h"
+
+namespace {
+// Number of each kind of record in an obj file, used to size the load arena
+struct ObjRecordCounts {
+    size_t vertices = 0;
+    size_t uvs = 0;
+    size_t normals = 0;
+    size_t faces = 0;
+};
+
+bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+const char* skip_spaces(const char* p, const char* end)
+{
+    while (p < end && is_space(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+std::string_view next_token(const char*& p, const char* end)
+{
+    p = skip_spaces(p, end);
+    const char* start = p;
+    while (p < end && !is_space(*p)) {
+        ++p;
+    }
+    return std::string_view(start, p - start);
+}
+
+// strtof and strtoul skip newlines as whitespace, so only call them when
+// there is something left on the current line
+float read_float(const char*& p, const char* end)
+{
+    p = skip_spaces(p, end);
+    if (p == end) {
+        return 0.f;
+    }
+    char* parsed_end;
+    float value = std::strtof(p, &parsed_end);
+    p = parsed_end;
+    return value;
+}
+
+size_t read_index(const char*& p, const char* end)
+{
+    p = skip_spaces(p, end);
+    if (p == end) {
+        return 0;
+    }
+    char* parsed_end;
+    size_t value = std::strtoul(p, &parsed_end, 10);
+    p = parsed_end;
+    return value;
+}
+
+template <typename F>
+void for_each_line(std::string_view contents, F&& f)
+{
+    size_t pos = 0;
+    while (pos < contents.size()) {
+        auto line_end = contents.find('\n', pos);
+        if (line_end == std::string_view::npos) {
+            line_end = contents.size();
+        }
+        f(contents.substr(pos, line_end - pos));
+        pos = line_end + 1;
+    }
+}
+
+ObjRecordCounts count_records(std::string_view contents)
+{
+    ObjRecordCounts counts;
+    for_each_line(contents, [&counts](std::string_view line) {
+        const char* p = line.data();
+        auto line_type = next_token(p, line.data() + line.size());
+        if (line_type == "v") {
+            counts.vertices++;
+        } else if (line_type == "vt") {
+            counts.uvs++;
+        } else if (line_type == "vn") {
+            counts.normals++;
+        } else if (line_type == "f") {
+            counts.faces++;
+        }
+    });
+    return counts;
+}
+}
+
+bool Mesh::load(const std::string& filename)
+{
+    auto dot = filename.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : filename.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    if (extension == "glb") {
+        return loadGlb(filename);
+    } else if (extension == "ply") {
+        return loadPly(filename);
+    } else if (extension != "obj") {
+        spdlog::warn("Unknown mesh extension \"{}\" for {}, trying obj", extension, filename);
+    }
+    return loadObj(filename);
+}
+
+void Mesh::beginPart(const std::string& name)
+{
+    parts.push_back({ name, indices.size(), 0 });
+}
+
+void Mesh::endParts()
+{
+    for (size_t i = 0; i < parts.size(); ++i) {
+        size_t end = i + 1 < parts.size() ? parts[i + 1].first_face : indices.size();
+        parts[i].face_count = end - parts[i].first_face;
+    }
+    parts.erase(std::remove_if(parts.begin(), parts.end(), [](const MeshPart& part) { return part.face_count == 0; }), parts.end());
+}
+
 bool Mesh::loadObj(const std::string& filename)
 {
-    std::ifstream obj_file(filename);
-    if (!obj_file)
+    AllocationCounter traffic;
+
+    auto contents_opt = read_file(filename);
+    if (!contents_opt)
         return false;
+    const std::string& contents = *contents_opt;
 
     vertices.clear();
     indices.clear();
+    parts.clear();
     model_name.clear();
 
-    std::vector<glm::vec3> input_vertices;
-    std::vector<glm::vec2> input_uvs;
-    std::vector<glm::vec3> input_normals;
+    // Size the arena from a quick pre-scan so the temporaries below are
+    // reserved once up front instead of growing while parsing
+    auto counts = count_records(contents);
+    size_t arena_size = counts.vertices * sizeof(glm::vec3)
+        + counts.uvs * sizeof(glm::vec2)
+        + counts.normals * sizeof(glm::vec3)
+        + 256; // alignment padding and bookkeeping of the arena
+    spdlog::debug("{} pre-scan: {} vertices, {} uvs, {} normals, {} faces, arena size {} bytes", filename, counts.vertices, counts.uvs, counts.normals, counts.faces, arena_size);
+
+    CountingResource heap;
+    std::pmr::monotonic_buffer_resource arena(arena_size, &heap);
+
+    std::pmr::vector<glm::vec3> input_vertices(&arena);
+    std::pmr::vector<glm::vec2> input_uvs(&arena);
+    std::pmr::vector<glm::vec3> input_normals(&arena);
+    input_vertices.reserve(counts.vertices);
+    input_uvs.reserve(counts.uvs);
+    input_normals.reserve(counts.normals);
 
-    std::string line;
+    // Every face is one triangle, but the deduplicated vertex count is only
+    // known after parsing. Most files reference each position, uv and normal
+    // at least once, so start from the largest of those and let the vertices
+    // grow when corners split them further.
+    vertices.reserve(std::max({ counts.vertices, counts.uvs, counts.normals }));
+    indices.reserve(counts.faces);
+    size_t output_regrowths = 0;
+    auto track_growth = [&output_regrowths](const auto& container, size_t old_capacity) {
+        if (container.capacity() != old_capacity) {
+            output_regrowths++;
+        }
+    };
+
+    // Faces before the first group still need a part
+    beginPart("");
 
-    while (std::getline(obj_file, line)) {
-        if (line.empty() || line[0] == '#')
-            continue;
+    bool ok = true;
+    for_each_line(contents, [&](std::string_view line) {
+        if (!ok || line.empty() || line[0] == '#')
+            return;
 
-        std::stringstream stream(line);
+        const char* p = line.data();
+        const char* end = line.data() + line.size();
 
-        std::string line_type;
-        stream >> line_type;
+        auto line_type = next_token(p, end);
 
         spdlog::trace("\treading line {}", line);
         if (line_type == "v") {
-            glm::vec3 vertex;
-            stream >> vertex.x;
-            stream >> vertex.y;
-            stream >> vertex.z;
+            glm::vec3 vertex(0.f);
+            vertex.x = read_float(p, end);
+            vertex.y = read_float(p, end);
+            vertex.z = read_float(p, end);
             input_vertices.push_back(vertex);
             spdlog::trace("\t\tread vertex {{{},{},{}}}", vertex.x, vertex.y, vertex.z);
         } else if (line_type == "vn") {
-            glm::vec3 normal;
-            stream >> normal.x;
-            stream >> normal.y;
-            stream >> normal.z;
+            glm::vec3 normal(0.f);
+            normal.x = read_float(p, end);
+            normal.y = read_float(p, end);
+            normal.z = read_float(p, end);
             input_normals.push_back(normal);
             spdlog::trace("\t\tread normal {{{},{},{}}}", normal.x, normal.y, normal.z);
         } else if (line_type == "vt") {
-            glm::vec2 uv;
-            stream >> uv.x;
-            stream >> uv.y;
+            glm::vec2 uv(0.f);
+            uv.x = read_float(p, end);
+            uv.y = read_float(p, end);
             input_uvs.push_back(uv);
             spdlog::trace("\t\tread uv {{{},{}}}", uv.x, uv.y);
         } else if (line_type == "f") {
             glm::uvec3 face;
             for (int i = 0; i < 3; i++) {
                 size_t vertex_index, uv_index, normal_index;
-                stream >> vertex_index;
+                vertex_index = read_index(p, end);
+                if (vertex_index == 0 || vertex_index > input_vertices.size()) {
+                    spdlog::error("Invalid vertex index {} in {} : \"{}\"", vertex_index, filename, line);
+                    ok = false;
+                    return;
+                }
 
                 uv_index = vertex_index;
-                if (stream.peek() == '/') {
-                    char slash;
-                    stream >> slash;
-                    if (stream.peek() != '/') {
-                        stream >> uv_index;
+                if (p < end && *p == '/') {
+                    ++p;
+                    if (p < end && *p != '/') {
+                        uv_index = read_index(p, end);
                     }
                 }
 
                 normal_index = vertex_index;
-                if (stream.peek() == '/') {
-                    char slash;
-                    stream >> slash;
-                    stream >> normal_index;
+                if (p < end && *p == '/') {
+                    ++p;
+                    normal_index = read_index(p, end);
                 }
 
                 Vertex v;
@@ -93,7 +258,9 @@ bool Mesh::loadObj(const std::string& filename)
                 auto it = std::find(vertices.begin(), vertices.end(), v);
                 if (it == vertices.end()) {
                     index = vertices.size();
+                    size_t old_capacity = vertices.capacity();
                     vertices.push_back(v);
+                    track_growth(vertices, old_capacity);
                 } else {
                     index = it - vertices.begin();
                 }
@@ -101,15 +268,30 @@ bool Mesh::loadObj(const std::string& filename)
                 face[i] = index;
             }
 
+            size_t old_capacity = indices.capacity();
             indices.push_back(face);
+            track_growth(indices, old_capacity);
         } else if (line_type == "g") {
-            stream >> model_name;
+            model_name = next_token(p, end);
+            beginPart(model_name);
             spdlog::trace("\t\tread name \"{}\"", model_name);
         } else {
             spdlog::warn("Unknown line in {} : \"{}\"", filename, line);
         }
+    });
+
+    if (!ok) {
+        spdlog::info("{} failed load: {} heap allocations, {} bytes peak", filename, traffic.allocation_count(), traffic.peak_bytes());
+        return false;
     }
 
-    spdlog::info("{} loaded, model name = \"{}\", {} vertices, {} uvs, {} normals, {} faces", filename, model_name, input_vertices.size(), input_uvs.size(), input_normals.size(), indices.size());
+    endParts();
+
+    // Measured by the counter up to here, so the logging below is not included
+    size_t output_bytes = vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(glm::uvec3);
+    spdlog::info("{} load: {} heap allocations, {} bytes allocated, {} bytes peak ({} arena allocations, {} output regrowths, {} bytes file, {} bytes output)",
+        filename, traffic.allocation_count(), traffic.total_bytes(), traffic.peak_bytes(), heap.allocation_count(), output_regrowths, contents.size(), output_bytes);
+
+    spdlog::info("{} loaded, model name = \"{}\", {} vertices, {} uvs, {} normals, {} faces in {} parts", filename, model_name, input_vertices.size(), input_uvs.size(), input_normals.size(), indices.size(), parts.size());
     return true;
 }
@@ -5,6 +5,13 @@
 
 #include "vertex.h"
 
+// A run of consecutive faces that came from one obj group or glTF primitive
+struct MeshPart {
+    std::string name;
+    size_t first_face;
+    size_t face_count;
+};
+
 class Mesh {
 public:
     Mesh() = default;
@@ -15,13 +22,33 @@ public:
     Mesh(Mesh&&) = default;
     Mesh& operator=(Mesh&&) = default;
 
+    // Picks a loader based on the file extension (.obj, .glb or .ply)
+    bool load(const std::string& filename);
+
     bool loadObj(const std::string& filename);
+    bool loadGlb(const std::string& filename);
+    bool loadPly(const std::string& filename);
+
+    // Fills in smooth normals for every vertex that has none, averaging the
+    // normals of the faces around it weighted by their angle at the vertex.
+    // Faces whose normals differ by more than crease_angle (in degrees) are
+    // not smoothed together, splitting the vertex where needed.
+    void generateNormals(float crease_angle);
 
     const std::vector<Vertex>& getVertices() { return vertices; }
     const std::vector<glm::uvec3>& getIndices() { return indices; }
+    // After a successful load these cover every face in order, any mesh
+    // with faces has at least one
+    const std::vector<MeshPart>& getParts() { return parts; }
 
 private:
+    // Starts a part at the next face to be added
+    void beginPart(const std::string& name);
+    // Sizes the parts from where the next one starts and drops empty ones
+    void endParts();
+
     std::vector<Vertex> vertices;
     std::vector<glm::uvec3> indices;
+    std::vector<MeshPart> parts;
     std::string model_name;
 };
@@ -0,0 +1,333 @@
+#include "mesh.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <spdlog/spdlog.h>
+
+#include "json.h"
+#include "utils.h"
+
+namespace {
+constexpr uint32_t GLB_MAGIC = 0x46546C67; // "glTF"
+constexpr uint32_t GLB_CHUNK_JSON = 0x4E4F534A;
+constexpr uint32_t GLB_CHUNK_BIN = 0x004E4942;
+
+constexpr int COMPONENT_UNSIGNED_BYTE = 5121;
+constexpr int COMPONENT_UNSIGNED_SHORT = 5123;
+constexpr int COMPONENT_UNSIGNED_INT = 5125;
+constexpr int COMPONENT_FLOAT = 5126;
+
+constexpr int MODE_TRIANGLES = 4;
+
+// glTF data is little endian and may be unaligned inside the binary chunk
+template <typename T>
+T read_as(const unsigned char* p)
+{
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+// Typed window into the binary chunk described by a glTF accessor
+struct AccessorView {
+    const unsigned char* data = nullptr; // first element
+    size_t count = 0;
+    size_t stride = 0;
+    int component_type = 0;
+    int components = 0;
+};
+
+size_t component_size(int component_type)
+{
+    switch (component_type) {
+    case 5120: // BYTE
+    case COMPONENT_UNSIGNED_BYTE:
+        return 1;
+    case 5122: // SHORT
+    case COMPONENT_UNSIGNED_SHORT:
+        return 2;
+    case COMPONENT_UNSIGNED_INT:
+    case COMPONENT_FLOAT:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+int component_count(const std::string& type)
+{
+    if (type == "SCALAR") {
+        return 1;
+    } else if (type == "VEC2") {
+        return 2;
+    } else if (type == "VEC3") {
+        return 3;
+    } else if (type == "VEC4") {
+        return 4;
+    }
+    return 0;
+}
+
+std::optional<AccessorView> resolve_accessor(const JsonValue& gltf, size_t index, const unsigned char* bin, size_t bin_size)
+{
+    auto accessors = gltf.find("accessors");
+    auto accessor = accessors ? accessors->at(index) : nullptr;
+    if (!accessor) {
+        spdlog::error("glTF accessor {} does not exist", index);
+        return {};
+    }
+    if (accessor->find("sparse")) {
+        spdlog::error("glTF accessor {} is sparse, which is not supported", index);
+        return {};
+    }
+
+    AccessorView view;
+    auto count = accessor->unsigned_or("count", 0);
+    auto component_type = accessor->unsigned_or("componentType", 0);
+    auto accessor_offset = accessor->unsigned_or("byteOffset", 0);
+    if (!count || !component_type || !accessor_offset) {
+        spdlog::error("glTF accessor {} has a count, component type or offset that is not a non-negative integer", index);
+        return {};
+    }
+    view.count = *count;
+    view.component_type = component_size(*component_type) != 0 ? static_cast<int>(*component_type) : 0;
+    view.components = component_count(accessor->string_or("type", ""));
+    size_t element_size = component_size(view.component_type) * view.components;
+    if (element_size == 0) {
+        spdlog::error("glTF accessor {} has an unsupported type", index);
+        return {};
+    }
+
+    auto buffer_view_index = accessor->find("bufferView");
+    auto buffer_view_position = buffer_view_index ? buffer_view_index->as_unsigned() : std::nullopt;
+    auto buffer_views = gltf.find("bufferViews");
+    auto buffer_view = (buffer_view_position && buffer_views) ? buffer_views->at(*buffer_view_position) : nullptr;
+    if (!buffer_view) {
+        spdlog::error("glTF accessor {} has no valid buffer view", index);
+        return {};
+    }
+    if (buffer_view->number_or("buffer", 0) != 0) {
+        spdlog::error("glTF accessor {} references an external buffer, only the GLB binary chunk is supported", index);
+        return {};
+    }
+
+    auto view_offset = buffer_view->unsigned_or("byteOffset", 0);
+    auto view_length = buffer_view->unsigned_or("byteLength", 0);
+    auto stride = buffer_view->unsigned_or("byteStride", 0);
+    if (!view_offset || !view_length || !stride) {
+        spdlog::error("glTF buffer view of accessor {} has an offset, length or stride that is not a non-negative integer", index);
+        return {};
+    }
+    // 0 means tightly packed
+    view.stride = *stride == 0 ? element_size : *stride;
+    if (view.stride < element_size) {
+        spdlog::error("glTF accessor {} has a stride of {} bytes, less than its {} byte elements", index, view.stride, element_size);
+        return {};
+    }
+
+    if (*view_offset > bin_size || *view_length > bin_size - *view_offset) {
+        spdlog::error("glTF buffer view of accessor {} lies outside the binary chunk", index);
+        return {};
+    }
+    // Divided rather than multiplied out, so a huge count cannot wrap around
+    if (view.count > 0
+        && (*accessor_offset > *view_length || element_size > *view_length - *accessor_offset
+            || view.count - 1 > (*view_length - *accessor_offset - element_size) / view.stride)) {
+        spdlog::error("glTF accessor {} lies outside its buffer view", index);
+        return {};
+    }
+
+    view.data = bin + *view_offset + *accessor_offset;
+    return view;
+}
+
+std::optional<AccessorView> resolve_attribute(const JsonValue& gltf, const JsonValue& attributes, const char* name, int components, const unsigned char* bin, size_t bin_size)
+{
+    auto index = attributes.find(name);
+    if (!index) {
+        return {};
+    }
+    auto accessor_index = index->as_unsigned();
+    if (!accessor_index) {
+        spdlog::warn("glTF attribute {} has an invalid accessor index, ignoring it", name);
+        return {};
+    }
+    auto view = resolve_accessor(gltf, *accessor_index, bin, bin_size);
+    if (view && (view->component_type != COMPONENT_FLOAT || view->components != components)) {
+        spdlog::warn("glTF attribute {} is not a float vec{}, ignoring it", name, components);
+        return {};
+    }
+    return view;
+}
+}
+
+bool Mesh::loadGlb(const std::string& filename)
+{
+    auto file_opt = map_file(filename);
+    if (!file_opt)
+        return false;
+    const unsigned char* data = file_opt->data();
+    size_t size = file_opt->size();
+
+    vertices.clear();
+    indices.clear();
+    parts.clear();
+    model_name.clear();
+
+    if (size < 12 || read_as<uint32_t>(data) != GLB_MAGIC || read_as<uint32_t>(data + 4) != 2) {
+        spdlog::error("{} is not a glTF 2.0 binary file", filename);
+        return false;
+    }
+
+    // Walk the chunks after the header, we need the JSON and BIN ones
+    std::string_view json_text;
+    const unsigned char* bin = nullptr;
+    size_t bin_size = 0;
+    size_t offset = 12;
+    while (offset + 8 <= size) {
+        uint32_t chunk_length = read_as<uint32_t>(data + offset);
+        uint32_t chunk_type = read_as<uint32_t>(data + offset + 4);
+        offset += 8;
+        if (chunk_length > size - offset) {
+            spdlog::error("{} has a truncated chunk", filename);
+            return false;
+        }
+        if (chunk_type == GLB_CHUNK_JSON && json_text.empty()) {
+            json_text = std::string_view(reinterpret_cast<const char*>(data + offset), chunk_length);
+        } else if (chunk_type == GLB_CHUNK_BIN && !bin) {
+            bin = data + offset;
+            bin_size = chunk_length;
+        }
+        offset += chunk_length;
+    }
+
+    auto gltf_opt = JsonValue::parse(json_text);
+    if (!gltf_opt || !gltf_opt->is_object()) {
+        spdlog::error("{} has no valid JSON chunk", filename);
+        return false;
+    }
+    const JsonValue& gltf = *gltf_opt;
+
+    auto meshes = gltf.find("meshes");
+    if (!meshes || !meshes->is_array() || meshes->size() == 0) {
+        spdlog::error("{} contains no meshes", filename);
+        return false;
+    }
+    model_name = meshes->at(0)->string_or("name", "");
+
+    // Node transforms are not applied, every primitive is loaded in its own space
+    for (size_t mesh_index = 0; mesh_index < meshes->size(); ++mesh_index) {
+        auto primitives = meshes->at(mesh_index)->find("primitives");
+        if (!primitives || !primitives->is_array()) {
+            continue;
+        }
+        for (size_t primitive_index = 0; primitive_index < primitives->size(); ++primitive_index) {
+            const JsonValue& primitive = *primitives->at(primitive_index);
+            if (primitive.number_or("mode", MODE_TRIANGLES) != MODE_TRIANGLES) {
+                spdlog::warn("{}: skipping mesh {} primitive {}, it is not a triangle list", filename, mesh_index, primitive_index);
+                continue;
+            }
+
+            auto attributes = primitive.find("attributes");
+            if (!attributes) {
+                continue;
+            }
+            auto positions = resolve_attribute(gltf, *attributes, "POSITION", 3, bin, bin_size);
+            if (!positions) {
+                spdlog::error("{}: mesh {} primitive {} has no usable POSITION attribute", filename, mesh_index, primitive_index);
+                return false;
+            }
+            auto normals = resolve_attribute(gltf, *attributes, "NORMAL", 3, bin, bin_size);
+            auto uvs = resolve_attribute(gltf, *attributes, "TEXCOORD_0", 2, bin, bin_size);
+            if ((normals && normals->count != positions->count) || (uvs && uvs->count != positions->count)) {
+                spdlog::error("{}: mesh {} primitive {} has mismatched attribute counts", filename, mesh_index, primitive_index);
+                return false;
+            }
+
+            size_t base = vertices.size();
+            size_t count = positions->count;
+            vertices.resize(base + count);
+
+            // Exporters that interleave exactly like Vertex let us copy the
+            // whole buffer view in one go
+            if (normals && uvs
+                && positions->stride == sizeof(Vertex) && normals->stride == sizeof(Vertex) && uvs->stride == sizeof(Vertex)
+                && uvs->data == positions->data + offsetof(Vertex, uv)
+                && normals->data == positions->data + offsetof(Vertex, normal)) {
+                std::memcpy(&vertices[base], positions->data, count * sizeof(Vertex));
+            } else {
+                for (size_t i = 0; i < count; ++i) {
+                    Vertex& v = vertices[base + i];
+                    v.pos = read_as<glm::vec3>(positions->data + i * positions->stride);
+                    if (uvs) {
+                        v.uv = read_as<glm::vec2>(uvs->data + i * uvs->stride);
+                    }
+                    if (normals) {
+                        v.normal = read_as<glm::vec3>(normals->data + i * normals->stride);
+                    }
+                }
+            }
+
+            beginPart(meshes->at(mesh_index)->string_or("name", ""));
+            auto index_accessor = primitive.find("indices");
+            if (!index_accessor) {
+                for (size_t i = 0; i + 2 < count; i += 3) {
+                    indices.emplace_back(static_cast<unsigned>(base + i), static_cast<unsigned>(base + i + 1), static_cast<unsigned>(base + i + 2));
+                }
+                continue;
+            }
+
+            auto index_accessor_position = index_accessor->as_unsigned();
+            auto index_view = index_accessor_position ? resolve_accessor(gltf, *index_accessor_position, bin, bin_size) : std::nullopt;
+            if (!index_view || index_view->components != 1 || index_view->count % 3 != 0) {
+                spdlog::error("{}: mesh {} primitive {} has invalid indices", filename, mesh_index, primitive_index);
+                return false;
+            }
+
+            size_t first_face = indices.size();
+            size_t face_count = index_view->count / 3;
+            indices.resize(first_face + face_count);
+            if (base == 0 && index_view->component_type == COMPONENT_UNSIGNED_INT && index_view->stride == sizeof(uint32_t)) {
+                std::memcpy(&indices[first_face], index_view->data, face_count * sizeof(glm::uvec3));
+            } else {
+                for (size_t i = 0; i < index_view->count; ++i) {
+                    const unsigned char* p = index_view->data + i * index_view->stride;
+                    uint32_t index;
+                    switch (index_view->component_type) {
+                    case COMPONENT_UNSIGNED_BYTE:
+                        index = read_as<uint8_t>(p);
+                        break;
+                    case COMPONENT_UNSIGNED_SHORT:
+                        index = read_as<uint16_t>(p);
+                        break;
+                    case COMPONENT_UNSIGNED_INT:
+                        index = read_as<uint32_t>(p);
+                        break;
+                    default:
+                        spdlog::error("{}: mesh {} primitive {} has signed indices", filename, mesh_index, primitive_index);
+                        return false;
+                    }
+                    indices[first_face + i / 3][i % 3] = base + index;
+                }
+            }
+
+            for (size_t f = first_face; f < indices.size(); ++f) {
+                for (int i = 0; i < 3; ++i) {
+                    if (indices[f][i] >= base + count) {
+                        spdlog::error("{}: mesh {} primitive {} has an out of range index", filename, mesh_index, primitive_index);
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    endParts();
+    spdlog::info("{} loaded, model name = \"{}\", {} vertices, {} faces in {} parts", filename, model_name, vertices.size(), indices.size(), parts.size());
+    return true;
+}
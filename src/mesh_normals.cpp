@@ -0,0 +1,156 @@
+#include "mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "utils.h"
+
+namespace {
+constexpr unsigned NO_VERTEX = ~0u;
+
+bool less_position(const glm::vec3& a, const glm::vec3& b)
+{
+    if (a.x != b.x) {
+        return a.x < b.x;
+    }
+    if (a.y != b.y) {
+        return a.y < b.y;
+    }
+    return a.z < b.z;
+}
+
+float angle_between(const glm::vec3& a, const glm::vec3& b)
+{
+    float len = glm::length(a) * glm::length(b);
+    if (len == 0.f) {
+        return 0.f;
+    }
+    return std::acos(glm::clamp(glm::dot(a, b) / len, -1.f, 1.f));
+}
+}
+
+void Mesh::generateNormals(float crease_angle)
+{
+    const glm::vec3 zero(0.f);
+    bool missing = std::any_of(vertices.begin(), vertices.end(), [&zero](const Vertex& v) { return v.normal == zero; });
+    if (!missing || indices.empty()) {
+        return;
+    }
+
+    size_t face_count = indices.size();
+
+    // Face normals and the angle of each face at each of its corners
+    std::vector<glm::vec3> face_normals(face_count);
+    std::vector<float> corner_angles(face_count * 3);
+    parallel_for(face_count, [&](size_t begin, size_t end) {
+        for (size_t f = begin; f < end; ++f) {
+            const auto& face = indices[f];
+            glm::vec3 p[3] = { vertices[face[0]].pos, vertices[face[1]].pos, vertices[face[2]].pos };
+            glm::vec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+            float len = glm::length(n);
+            face_normals[f] = len > 0.f ? n / len : glm::vec3(0.f);
+            for (int i = 0; i < 3; ++i) {
+                corner_angles[f * 3 + i] = angle_between(p[(i + 1) % 3] - p[i], p[(i + 2) % 3] - p[i]);
+            }
+        }
+    });
+
+    // Vertices split by uv still share a position, so weld them by position
+    // to find every face around a point
+    std::vector<unsigned> order(vertices.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [this](unsigned a, unsigned b) { return less_position(vertices[a].pos, vertices[b].pos); });
+    std::vector<unsigned> position_ids(vertices.size());
+    unsigned position_count = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (i > 0 && vertices[order[i]].pos != vertices[order[i - 1]].pos) {
+            position_count++;
+        }
+        position_ids[order[i]] = position_count;
+    }
+    position_count++;
+
+    // Corners (face * 3 + i) touching each position, in compressed rows
+    std::vector<unsigned> row_start(position_count + 1, 0);
+    for (const auto& face : indices) {
+        for (int i = 0; i < 3; ++i) {
+            row_start[position_ids[face[i]] + 1]++;
+        }
+    }
+    std::partial_sum(row_start.begin(), row_start.end(), row_start.begin());
+    std::vector<unsigned> corners(face_count * 3);
+    {
+        std::vector<unsigned> fill(row_start.begin(), row_start.end() - 1);
+        for (size_t f = 0; f < face_count; ++f) {
+            for (int i = 0; i < 3; ++i) {
+                corners[fill[position_ids[indices[f][i]]]++] = f * 3 + i;
+            }
+        }
+    }
+
+    // Angle weighted average over the faces within the crease angle
+    float cos_crease = std::cos(glm::radians(crease_angle));
+    std::vector<glm::vec3> corner_normals(face_count * 3);
+    parallel_for(face_count, [&](size_t begin, size_t end) {
+        for (size_t f = begin; f < end; ++f) {
+            for (int i = 0; i < 3; ++i) {
+                unsigned vertex = indices[f][i];
+                if (vertices[vertex].normal != zero) {
+                    continue;
+                }
+                unsigned position = position_ids[vertex];
+                // Degenerate faces have no direction of their own to crease against
+                bool degenerate = face_normals[f] == zero;
+                glm::vec3 sum(0.f);
+                for (unsigned c = row_start[position]; c < row_start[position + 1]; ++c) {
+                    unsigned other_face = corners[c] / 3;
+                    if (degenerate || glm::dot(face_normals[f], face_normals[other_face]) >= cos_crease) {
+                        sum += face_normals[other_face] * corner_angles[corners[c]];
+                    }
+                }
+                float len = glm::length(sum);
+                corner_normals[f * 3 + i] = len > 0.f ? sum / len : face_normals[f];
+            }
+        }
+    });
+
+    // Corners of one vertex that ended up in different smoothing groups get
+    // their own copy of the vertex, chained from the original one
+    size_t original_count = vertices.size();
+    std::vector<unsigned> next_split(original_count, NO_VERTEX);
+    std::vector<bool> assigned(original_count, false);
+    for (size_t f = 0; f < face_count; ++f) {
+        for (int i = 0; i < 3; ++i) {
+            unsigned vertex = indices[f][i];
+            if (!assigned[vertex] && vertices[vertex].normal != zero) {
+                continue;
+            }
+            const glm::vec3& normal = corner_normals[f * 3 + i];
+            if (!assigned[vertex]) {
+                vertices[vertex].normal = normal;
+                assigned[vertex] = true;
+                continue;
+            }
+
+            unsigned current = vertex;
+            while (vertices[current].normal != normal && next_split[current] != NO_VERTEX) {
+                current = next_split[current];
+            }
+            if (vertices[current].normal != normal) {
+                Vertex split = vertices[vertex];
+                split.normal = normal;
+                next_split[current] = vertices.size();
+                next_split.push_back(NO_VERTEX);
+                vertices.push_back(split);
+                current = next_split[current];
+            }
+            indices[f][i] = current;
+        }
+    }
+
+    spdlog::info("generated normals with a {} degree crease angle, {} vertices added by splits", crease_angle, vertices.size() - original_count);
+}
@@ -0,0 +1,413 @@
+#include "mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "utils.h"
+
+namespace {
+enum class PlyType {
+    Invalid,
+    Int8,
+    UInt8,
+    Int16,
+    UInt16,
+    Int32,
+    UInt32,
+    Float32,
+    Float64
+};
+
+struct PlyProperty {
+    std::string name;
+    PlyType type = PlyType::Invalid;
+    bool is_list = false;
+    PlyType count_type = PlyType::Invalid; // only for lists
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PlyProperty> properties;
+};
+
+PlyType parse_type(std::string_view name)
+{
+    if (name == "char" || name == "int8") {
+        return PlyType::Int8;
+    } else if (name == "uchar" || name == "uint8") {
+        return PlyType::UInt8;
+    } else if (name == "short" || name == "int16") {
+        return PlyType::Int16;
+    } else if (name == "ushort" || name == "uint16") {
+        return PlyType::UInt16;
+    } else if (name == "int" || name == "int32") {
+        return PlyType::Int32;
+    } else if (name == "uint" || name == "uint32") {
+        return PlyType::UInt32;
+    } else if (name == "float" || name == "float32") {
+        return PlyType::Float32;
+    } else if (name == "double" || name == "float64") {
+        return PlyType::Float64;
+    }
+    return PlyType::Invalid;
+}
+
+size_t type_size(PlyType type)
+{
+    switch (type) {
+    case PlyType::Int8:
+    case PlyType::UInt8:
+        return 1;
+    case PlyType::Int16:
+    case PlyType::UInt16:
+        return 2;
+    case PlyType::Int32:
+    case PlyType::UInt32:
+    case PlyType::Float32:
+        return 4;
+    case PlyType::Float64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// Assumes a little endian host, so big endian files need their bytes swapped
+template <typename T>
+T read_scalar(const unsigned char* p, bool swap)
+{
+    unsigned char bytes[sizeof(T)];
+    std::memcpy(bytes, p, sizeof(T));
+    if (swap) {
+        std::reverse(bytes, bytes + sizeof(T));
+    }
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+// Sequential reader over the binary body of a ply file
+class PlyReader {
+public:
+    PlyReader(const unsigned char* p, const unsigned char* end, bool swap)
+        : p(p)
+        , end(end)
+        , swap(swap)
+    {
+    }
+
+    bool read(PlyType type, double& out)
+    {
+        size_t size = type_size(type);
+        if (size == 0 || static_cast<size_t>(end - p) < size) {
+            return false;
+        }
+        switch (type) {
+        case PlyType::Int8:
+            out = read_scalar<int8_t>(p, swap);
+            break;
+        case PlyType::UInt8:
+            out = read_scalar<uint8_t>(p, swap);
+            break;
+        case PlyType::Int16:
+            out = read_scalar<int16_t>(p, swap);
+            break;
+        case PlyType::UInt16:
+            out = read_scalar<uint16_t>(p, swap);
+            break;
+        case PlyType::Int32:
+            out = read_scalar<int32_t>(p, swap);
+            break;
+        case PlyType::UInt32:
+            out = read_scalar<uint32_t>(p, swap);
+            break;
+        case PlyType::Float32:
+            out = read_scalar<float>(p, swap);
+            break;
+        case PlyType::Float64:
+            out = read_scalar<double>(p, swap);
+            break;
+        default:
+            return false;
+        }
+        p += size;
+        return true;
+    }
+
+    const unsigned char* position() const { return p; }
+    size_t remaining() const { return end - p; }
+    void skip(size_t bytes) { p += bytes; }
+
+private:
+    const unsigned char* p;
+    const unsigned char* end;
+    bool swap;
+};
+
+// A list count or vertex index read as a double. Like JsonValue::as_unsigned,
+// only non-negative integers are accepted, here up to UINT32_MAX, so the cast
+// is always defined.
+bool to_index(double value, uint32_t& out)
+{
+    if (!(value >= 0.0) || value > static_cast<double>(UINT32_MAX) || std::floor(value) != value) {
+        return false;
+    }
+    out = static_cast<uint32_t>(value);
+    return true;
+}
+
+// Index into the floats of a Vertex (pos, uv, normal) that a property fills
+int vertex_slot(const std::string& name)
+{
+    static const char* const slots[][3] = {
+        { "x", nullptr, nullptr },
+        { "y", nullptr, nullptr },
+        { "z", nullptr, nullptr },
+        { "s", "u", "texture_u" },
+        { "t", "v", "texture_v" },
+        { "nx", nullptr, nullptr },
+        { "ny", nullptr, nullptr },
+        { "nz", nullptr, nullptr },
+    };
+    for (int slot = 0; slot < 8; ++slot) {
+        for (auto alias : slots[slot]) {
+            if (alias && name == alias) {
+                return slot;
+            }
+        }
+    }
+    return -1;
+}
+
+std::vector<std::string_view> split_words(std::string_view line)
+{
+    std::vector<std::string_view> words;
+    size_t pos = 0;
+    while (pos < line.size()) {
+        auto start = line.find_first_not_of(" \t\r", pos);
+        if (start == std::string_view::npos) {
+            break;
+        }
+        auto stop = line.find_first_of(" \t\r", start);
+        if (stop == std::string_view::npos) {
+            stop = line.size();
+        }
+        words.push_back(line.substr(start, stop - start));
+        pos = stop;
+    }
+    return words;
+}
+}
+
+bool Mesh::loadPly(const std::string& filename)
+{
+    auto file_opt = map_file(filename);
+    if (!file_opt)
+        return false;
+    std::string_view text(reinterpret_cast<const char*>(file_opt->data()), file_opt->size());
+
+    vertices.clear();
+    indices.clear();
+    parts.clear();
+    model_name.clear();
+
+    if (text.substr(0, 4) != "ply\n" && text.substr(0, 5) != "ply\r\n") {
+        spdlog::error("{} is not a ply file", filename);
+        return false;
+    }
+
+    // Parse the ascii header, the binary body starts right after end_header
+    std::vector<PlyElement> elements;
+    bool swap = false;
+    size_t body_offset = 0;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        auto line_end = text.find('\n', pos);
+        if (line_end == std::string_view::npos) {
+            break;
+        }
+        auto line = text.substr(pos, line_end - pos);
+        auto words = split_words(line);
+        pos = line_end + 1;
+        if (words.empty()) {
+            continue;
+        }
+
+        if (words[0] == "end_header") {
+            body_offset = pos;
+            break;
+        } else if (words[0] == "format" && words.size() >= 2) {
+            if (words[1] == "binary_little_endian") {
+                swap = false;
+            } else if (words[1] == "binary_big_endian") {
+                swap = true;
+            } else {
+                spdlog::error("{}: only binary ply files are supported, not \"{}\"", filename, words[1]);
+                return false;
+            }
+        } else if (words[0] == "element" && words.size() >= 3) {
+            PlyElement element;
+            element.name = words[1];
+            element.count = std::strtoull(std::string(words[2]).c_str(), nullptr, 10);
+            elements.push_back(element);
+        } else if (words[0] == "property" && !elements.empty()) {
+            PlyProperty property;
+            if (words.size() >= 5 && words[1] == "list") {
+                property.is_list = true;
+                property.count_type = parse_type(words[2]);
+                property.type = parse_type(words[3]);
+                property.name = words[4];
+            } else if (words.size() >= 3) {
+                property.type = parse_type(words[1]);
+                property.name = words[2];
+            }
+            if (property.type == PlyType::Invalid || (property.is_list && property.count_type == PlyType::Invalid)) {
+                spdlog::error("{}: unsupported property \"{}\"", filename, line);
+                return false;
+            }
+            elements.back().properties.push_back(property);
+        } else if (words[0] == "obj_info" && words.size() >= 2 && model_name.empty()) {
+            model_name = words[1];
+        }
+    }
+    if (body_offset == 0) {
+        spdlog::error("{} has no end_header", filename);
+        return false;
+    }
+
+    PlyReader reader(file_opt->data() + body_offset, file_opt->data() + file_opt->size(), swap);
+    for (const auto& element : elements) {
+        // Reject counts the rest of the file cannot possibly hold before allocating for them
+        size_t min_record_size = 0;
+        for (const auto& property : element.properties) {
+            min_record_size += type_size(property.is_list ? property.count_type : property.type);
+        }
+        if (min_record_size == 0 && element.count > 0) {
+            spdlog::error("{}: element {} has {} records but no properties", filename, element.name, element.count);
+            return false;
+        }
+        if (min_record_size > 0 && element.count > reader.remaining() / min_record_size) {
+            spdlog::error("{} is truncated, {} {} elements do not fit", filename, element.count, element.name);
+            return false;
+        }
+
+        if (element.name == "vertex") {
+            std::vector<int> slots;
+            bool matches_vertex_layout = !swap && element.properties.size() == 8;
+            for (size_t i = 0; i < element.properties.size(); ++i) {
+                const auto& property = element.properties[i];
+                int slot = property.is_list ? -1 : vertex_slot(property.name);
+                slots.push_back(slot);
+                matches_vertex_layout = matches_vertex_layout && slot == static_cast<int>(i) && property.type == PlyType::Float32;
+            }
+
+            vertices.resize(element.count);
+            // Files written with exactly Vertex's layout are copied straight out of the mapping
+            if (matches_vertex_layout && reader.remaining() / sizeof(Vertex) >= element.count) {
+                std::memcpy(vertices.data(), reader.position(), element.count * sizeof(Vertex));
+                reader.skip(element.count * sizeof(Vertex));
+                continue;
+            }
+
+            for (auto& v : vertices) {
+                float values[8] = {};
+                for (size_t i = 0; i < element.properties.size(); ++i) {
+                    const auto& property = element.properties[i];
+                    double value;
+                    if (property.is_list) {
+                        double count_value;
+                        if (!reader.read(property.count_type, count_value)) {
+                            spdlog::error("{} is truncated", filename);
+                            return false;
+                        }
+                        uint32_t count;
+                        if (!to_index(count_value, count)) {
+                            spdlog::error("{} has an invalid list count {}", filename, count_value);
+                            return false;
+                        }
+                        for (size_t j = 0; j < count; ++j) {
+                            if (!reader.read(property.type, value)) {
+                                spdlog::error("{} is truncated", filename);
+                                return false;
+                            }
+                        }
+                        continue;
+                    }
+                    if (!reader.read(property.type, value)) {
+                        spdlog::error("{} is truncated", filename);
+                        return false;
+                    }
+                    if (slots[i] >= 0) {
+                        values[slots[i]] = static_cast<float>(value);
+                    }
+                }
+                v.pos = glm::vec3(values[0], values[1], values[2]);
+                v.uv = glm::vec2(values[3], values[4]);
+                v.normal = glm::vec3(values[5], values[6], values[7]);
+            }
+        } else {
+            bool is_face = element.name == "face";
+            if (is_face) {
+                indices.reserve(element.count);
+            }
+            std::vector<uint32_t> polygon;
+            for (size_t n = 0; n < element.count; ++n) {
+                for (const auto& property : element.properties) {
+                    bool is_polygon = is_face && property.is_list && (property.name == "vertex_indices" || property.name == "vertex_index");
+                    double value;
+                    uint32_t count = 1;
+                    if (property.is_list) {
+                        if (!reader.read(property.count_type, value)) {
+                            spdlog::error("{} is truncated", filename);
+                            return false;
+                        }
+                        if (!to_index(value, count)) {
+                            spdlog::error("{} has an invalid list count {}", filename, value);
+                            return false;
+                        }
+                    }
+                    polygon.clear();
+                    for (size_t j = 0; j < count; ++j) {
+                        if (!reader.read(property.type, value)) {
+                            spdlog::error("{} is truncated", filename);
+                            return false;
+                        }
+                        if (is_polygon) {
+                            uint32_t index;
+                            if (!to_index(value, index)) {
+                                spdlog::error("{} has an invalid vertex index {}", filename, value);
+                                return false;
+                            }
+                            polygon.push_back(index);
+                        }
+                    }
+                    // Triangulate polygons as a fan around their first vertex
+                    for (size_t j = 2; j < polygon.size(); ++j) {
+                        indices.emplace_back(polygon[0], polygon[j - 1], polygon[j]);
+                    }
+                }
+            }
+        }
+    }
+
+    for (const auto& face : indices) {
+        if (face.x >= vertices.size() || face.y >= vertices.size() || face.z >= vertices.size()) {
+            spdlog::error("{} has an out of range vertex index", filename);
+            return false;
+        }
+    }
+
+    parts.push_back({ model_name, 0, indices.size() });
+    endParts();
+    spdlog::info("{} loaded, model name = \"{}\", {} vertices, {} faces", filename, model_name, vertices.size(), indices.size());
+    return true;
+}
@@ -0,0 +1,138 @@
+#include "render_state.h"
+
+#include <algorithm>
+#include <tuple>
+
+void RenderStateCache::use_program(GLuint program)
+{
+    if (program_known && current_program == program) {
+        saved++;
+        return;
+    }
+    glUseProgram(program);
+    current_program = program;
+    program_known = true;
+    issued++;
+}
+
+void RenderStateCache::bind_vertex_array(GLuint vao)
+{
+    if (vao_known && current_vao == vao) {
+        saved++;
+        return;
+    }
+    glBindVertexArray(vao);
+    current_vao = vao;
+    vao_known = true;
+    issued++;
+}
+
+void RenderStateCache::bind_texture(GLuint texture)
+{
+    if (texture_known && current_texture == texture) {
+        saved++;
+        return;
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    current_texture = texture;
+    texture_known = true;
+    issued++;
+}
+
+void RenderStateCache::polygon_mode(GLenum mode)
+{
+    if (polygon_mode_known && current_polygon_mode == mode) {
+        saved++;
+        return;
+    }
+    glPolygonMode(GL_FRONT_AND_BACK, mode);
+    current_polygon_mode = mode;
+    polygon_mode_known = true;
+    issued++;
+}
+
+void RenderStateCache::invalidate()
+{
+    program_known = false;
+    vao_known = false;
+    texture_known = false;
+    polygon_mode_known = false;
+}
+
+void RenderStateCache::count_draw(size_t merged)
+{
+    issued++;
+    saved += merged;
+}
+
+void RenderStateCache::reset_counters()
+{
+    issued = 0;
+    saved = 0;
+}
+
+void DrawQueue::submit(DrawCommand command)
+{
+    commands.push_back(std::move(command));
+}
+
+void DrawQueue::flush(RenderStateCache& state)
+{
+    auto key = [](const DrawCommand& c) { return std::make_tuple(c.program, c.vao, c.texture, c.polygon_mode); };
+    // Stable so that draws sharing all state keep their submission order
+    std::stable_sort(commands.begin(), commands.end(), [&key](const DrawCommand& a, const DrawCommand& b) { return key(a) < key(b); });
+
+    for (size_t i = 0; i < commands.size();) {
+        const DrawCommand& first = commands[i];
+
+        // Extend the batch over following draws that need nothing different
+        size_t end = i + 1;
+        if (!first.set_uniforms) {
+            while (end < commands.size()
+                && key(commands[end]) == key(first)
+                && !commands[end].set_uniforms
+                && commands[end].primitive == first.primitive
+                && commands[end].indexed == first.indexed) {
+                ++end;
+            }
+        }
+
+        state.polygon_mode(first.polygon_mode);
+        state.use_program(first.program);
+        state.bind_vertex_array(first.vao);
+        if (first.texture != 0) {
+            state.bind_texture(first.texture);
+        }
+        if (first.set_uniforms) {
+            first.set_uniforms();
+        }
+
+        size_t batch_size = end - i;
+        if (batch_size == 1) {
+            if (first.indexed) {
+                glDrawElements(first.primitive, first.count, GL_UNSIGNED_INT, reinterpret_cast<const void*>(first.first * sizeof(GLuint)));
+            } else {
+                glDrawArrays(first.primitive, first.first, first.count);
+            }
+        } else {
+            batch_counts.clear();
+            batch_firsts.clear();
+            batch_offsets.clear();
+            for (size_t j = i; j < end; ++j) {
+                batch_counts.push_back(commands[j].count);
+                batch_firsts.push_back(commands[j].first);
+                batch_offsets.push_back(reinterpret_cast<const void*>(commands[j].first * sizeof(GLuint)));
+            }
+            if (first.indexed) {
+                glMultiDrawElements(first.primitive, batch_counts.data(), GL_UNSIGNED_INT, batch_offsets.data(), batch_size);
+            } else {
+                glMultiDrawArrays(first.primitive, batch_firsts.data(), batch_counts.data(), batch_size);
+            }
+        }
+        state.count_draw(batch_size - 1);
+
+        i = end;
+    }
+
+    commands.clear();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include <epoxy/gl.h>
+
+// Shadows the GL state the renderer changes between draws, so that setting
+// state to the value it already has never reaches the driver. Only texture
+// unit 0 is tracked and it is assumed to stay the active unit.
+class RenderStateCache {
+public:
+    RenderStateCache() = default;
+
+    RenderStateCache(const RenderStateCache&) = delete;
+    RenderStateCache& operator=(const RenderStateCache&) = delete;
+
+    void use_program(GLuint program);
+    void bind_vertex_array(GLuint vao);
+    void bind_texture(GLuint texture);
+    void polygon_mode(GLenum mode);
+
+    // Call after code outside the cache changed the bound texture
+    void invalidate_texture() { texture_known = false; }
+    // Call after code outside the cache changed any of the tracked state
+    void invalidate();
+
+    // A draw call issued or merged into another one
+    void count_draw(size_t merged);
+
+    size_t calls_issued() const { return issued; }
+    size_t calls_saved() const { return saved; }
+    void reset_counters();
+
+private:
+    GLuint current_program = 0;
+    GLuint current_vao = 0;
+    GLuint current_texture = 0;
+    GLenum current_polygon_mode = GL_FILL;
+
+    // GL defaults are not assumed, the first change of each is always issued
+    bool program_known = false;
+    bool vao_known = false;
+    bool texture_known = false;
+    bool polygon_mode_known = false;
+
+    size_t issued = 0;
+    size_t saved = 0;
+};
+
+// A draw and the state it needs. The state fields are the sort key.
+struct DrawCommand {
+    GLuint program = 0;
+    GLuint vao = 0;
+    GLuint texture = 0; // material, 0 leaves the bound texture alone
+    GLenum polygon_mode = GL_FILL;
+
+    GLenum primitive = GL_TRIANGLES;
+    bool indexed = true; // GL_UNSIGNED_INT indices in the VAO's element buffer
+    GLint first = 0; // first index or vertex
+    GLsizei count = 0;
+
+    // Runs right after the program is bound, for per draw uniforms. Draws
+    // without one can be merged into a single multi-draw call.
+    std::function<void()> set_uniforms;
+};
+
+// Collects the draws of a frame and submits them sorted by program, VAO,
+// material and polygon mode so that state changes are grouped together.
+class DrawQueue {
+public:
+    void submit(DrawCommand command);
+
+    // Issues all submitted draws through state and empties the queue
+    void flush(RenderStateCache& state);
+
+private:
+    std::vector<DrawCommand> commands;
+
+    // Scratch space for multi-draw calls, kept to avoid reallocating
+    std::vector<GLsizei> batch_counts;
+    std::vector<GLint> batch_firsts;
+    std::vector<const void*> batch_offsets;
+};
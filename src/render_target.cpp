@@ -0,0 +1,81 @@
+#include "render_target.h"
+
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+RenderTarget::~RenderTarget()
+{
+    release();
+}
+
+void RenderTarget::release()
+{
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &color_buffer);
+    glDeleteRenderbuffers(1, &depth_buffer);
+    framebuffer = 0;
+    color_buffer = 0;
+    depth_buffer = 0;
+    target_width = 0;
+    target_height = 0;
+}
+
+bool RenderTarget::resize(int width, int height)
+{
+    if (framebuffer != 0 && width == target_width && height == target_height) {
+        return true;
+    }
+    release();
+    if (width <= 0 || height <= 0) {
+        spdlog::error("Invalid render target size {}x{}", width, height);
+        return false;
+    }
+
+    glGenRenderbuffers(1, &color_buffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, color_buffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &depth_buffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_buffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        spdlog::error("Render target of {}x{} is incomplete (status 0x{:x})", width, height, status);
+        release();
+        return false;
+    }
+
+    target_width = width;
+    target_height = height;
+    return true;
+}
+
+void RenderTarget::bind() const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void RenderTarget::present(int window_width, int window_height) const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, window_width, window_height);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Largest rectangle with the target's aspect ratio, centered in the window
+    double scale = std::min(window_width / double(target_width), window_height / double(target_height));
+    int width = static_cast<int>(target_width * scale);
+    int height = static_cast<int>(target_height * scale);
+    int x = (window_width - width) / 2;
+    int y = (window_height - height) / 2;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBlitFramebuffer(0, 0, target_width, target_height, x, y, x + width, y + height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
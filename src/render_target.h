@@ -0,0 +1,36 @@
+#pragma once
+
+#include <epoxy/gl.h>
+
+// Framebuffer with color and depth renderbuffers of a fixed size, for
+// rendering at a size that does not depend on the window
+class RenderTarget {
+public:
+    RenderTarget() = default;
+    ~RenderTarget();
+
+    RenderTarget(const RenderTarget&) = delete;
+    RenderTarget& operator=(const RenderTarget&) = delete;
+
+    // Recreates the buffers if the size changed. Returns false if the
+    // framebuffer is not complete.
+    bool resize(int width, int height);
+
+    void bind() const;
+
+    // Scales the target onto the default framebuffer, keeping its aspect
+    // ratio, and leaves the default framebuffer bound
+    void present(int window_width, int window_height) const;
+
+    int width() const { return target_width; }
+    int height() const { return target_height; }
+
+private:
+    void release();
+
+    GLuint framebuffer = 0;
+    GLuint color_buffer = 0;
+    GLuint depth_buffer = 0;
+    int target_width = 0;
+    int target_height = 0;
+};
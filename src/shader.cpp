@@ -1,6 +1,7 @@
 #include "shader.h"
 
 #include <string>
+#include <vector>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -145,6 +146,26 @@ bool ShaderProgram::set_uniform_mat4(const std::string& uniform, const glm::mat4
     return true;
 }
 
+bool ShaderProgram::set_uniform_vec3_array(const std::string& uniform, const std::vector<glm::vec3>& values)
+{
+    auto loc = glGetUniformLocation(shader_program_id, uniform.c_str());
+    if (loc == -1) {
+        return false;
+    }
+    glUniform3fv(loc, values.size(), reinterpret_cast<const GLfloat*>(values.data()));
+    return true;
+}
+
+bool ShaderProgram::set_uniform_mat4_array(const std::string& uniform, const std::vector<glm::mat4>& values)
+{
+    auto loc = glGetUniformLocation(shader_program_id, uniform.c_str());
+    if (loc == -1) {
+        return false;
+    }
+    glUniformMatrix4fv(loc, values.size(), GL_FALSE, reinterpret_cast<const GLfloat*>(values.data()));
+    return true;
+}
+
 GLint ShaderProgram::get_attribute_location(const std::string& attribute)
 {
     return glGetAttribLocation(shader_program_id, attribute.c_str());
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <epoxy/gl.h>
 #include <glm/glm.hpp>
@@ -19,10 +20,15 @@ public:
     void use();
     void unuse();
 
+    GLuint id() const { return shader_program_id; }
+
     bool set_uniform_int(const std::string& uniform, int value);
     bool set_uniform_float(const std::string& uniform, float value);
     bool set_uniform_vec3(const std::string& uniform, const glm::vec3& value);
     bool set_uniform_mat4(const std::string& uniform, const glm::mat4& value);
+    // Sets the first values.size() elements of a uniform array
+    bool set_uniform_vec3_array(const std::string& uniform, const std::vector<glm::vec3>& values);
+    bool set_uniform_mat4_array(const std::string& uniform, const std::vector<glm::mat4>& values);
 
     GLint get_attribute_location(const std::string& attribute);
 
@@ -0,0 +1,500 @@
+#include "texture.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+
+#include "utils.h"
+
+namespace {
+constexpr unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+constexpr uint32_t KTX_ENDIANNESS = 0x04030201;
+
+// Fields of the KTX 1 header following the identifier, in file order
+struct KtxHeader {
+    uint32_t endianness;
+    uint32_t gl_type;
+    uint32_t gl_type_size;
+    uint32_t gl_format;
+    uint32_t gl_internal_format;
+    uint32_t gl_base_internal_format;
+    uint32_t pixel_width;
+    uint32_t pixel_height;
+    uint32_t pixel_depth;
+    uint32_t number_of_array_elements;
+    uint32_t number_of_faces;
+    uint32_t number_of_mipmap_levels;
+    uint32_t bytes_of_key_value_data;
+};
+
+// glTexStorage2D only takes sized formats
+GLenum sized_format(GLenum internal_format)
+{
+    switch (internal_format) {
+    case GL_RGBA:
+        return GL_RGBA8;
+    case GL_RGB:
+        return GL_RGB8;
+    case GL_RG:
+        return GL_RG8;
+    case GL_RED:
+        return GL_R8;
+    default:
+        return internal_format;
+    }
+}
+
+// Bytes per 4x4 block of the compressed formats we know, 0 for any other
+size_t block_size(GLenum internal_format)
+{
+    switch (internal_format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RED_RGTC1:
+    case GL_COMPRESSED_SIGNED_RED_RGTC1:
+    case GL_COMPRESSED_RGB8_ETC2:
+    case GL_COMPRESSED_SRGB8_ETC2:
+    case GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+    case GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+    case GL_COMPRESSED_R11_EAC:
+    case GL_COMPRESSED_SIGNED_R11_EAC:
+        return 8;
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+    case GL_COMPRESSED_RG_RGTC2:
+    case GL_COMPRESSED_SIGNED_RG_RGTC2:
+    case GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT:
+    case GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT:
+    case GL_COMPRESSED_RGBA_BPTC_UNORM:
+    case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+    case GL_COMPRESSED_RGBA8_ETC2_EAC:
+    case GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC:
+    case GL_COMPRESSED_RG11_EAC:
+    case GL_COMPRESSED_SIGNED_RG11_EAC:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+// Bytes per pixel of uncompressed data, 0 for combinations we don't know
+size_t pixel_size(GLenum format, GLenum type)
+{
+    switch (type) {
+    case GL_UNSIGNED_SHORT_5_6_5:
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+    case GL_UNSIGNED_SHORT_5_5_5_1:
+        return 2;
+    case GL_UNSIGNED_INT_8_8_8_8:
+    case GL_UNSIGNED_INT_8_8_8_8_REV:
+    case GL_UNSIGNED_INT_2_10_10_10_REV:
+    case GL_UNSIGNED_INT_10F_11F_11F_REV:
+    case GL_UNSIGNED_INT_5_9_9_9_REV:
+        return 4;
+    }
+
+    size_t component_size;
+    switch (type) {
+    case GL_UNSIGNED_BYTE:
+    case GL_BYTE:
+        component_size = 1;
+        break;
+    case GL_UNSIGNED_SHORT:
+    case GL_SHORT:
+    case GL_HALF_FLOAT:
+        component_size = 2;
+        break;
+    case GL_UNSIGNED_INT:
+    case GL_INT:
+    case GL_FLOAT:
+        component_size = 4;
+        break;
+    default:
+        return 0;
+    }
+
+    switch (format) {
+    case GL_RED:
+        return component_size;
+    case GL_RG:
+        return 2 * component_size;
+    case GL_RGB:
+    case GL_BGR:
+        return 3 * component_size;
+    case GL_RGBA:
+    case GL_BGRA:
+        return 4 * component_size;
+    default:
+        return 0;
+    }
+}
+}
+
+std::optional<TextureImage> load_ktx(const std::string& filename)
+{
+    auto contents_opt = read_file(filename);
+    if (!contents_opt)
+        return {};
+
+    TextureImage image;
+    image.data = std::move(*contents_opt);
+    const std::string& data = image.data;
+
+    KtxHeader header;
+    if (data.size() < sizeof(KTX_IDENTIFIER) + sizeof(header) || std::memcmp(data.data(), KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0) {
+        spdlog::error("\"{}\" is not a KTX file", filename);
+        return {};
+    }
+    std::memcpy(&header, data.data() + sizeof(KTX_IDENTIFIER), sizeof(header));
+    if (header.endianness != KTX_ENDIANNESS) {
+        spdlog::error("\"{}\" was written with a different endianness", filename);
+        return {};
+    }
+    if (header.pixel_width == 0 || header.pixel_height == 0 || header.pixel_depth > 1
+        || header.number_of_array_elements > 0 || header.number_of_faces != 1) {
+        spdlog::error("\"{}\" is not a plain 2D texture", filename);
+        return {};
+    }
+    uint32_t max_level_count = 1;
+    for (uint32_t size = std::max(header.pixel_width, header.pixel_height); size > 1; size >>= 1) {
+        max_level_count++;
+    }
+    if (header.number_of_mipmap_levels > max_level_count) {
+        spdlog::error("\"{}\" has {} mip levels, a {}x{} texture has at most {}", filename, header.number_of_mipmap_levels, header.pixel_width, header.pixel_height, max_level_count);
+        return {};
+    }
+
+    image.internal_format = sized_format(header.gl_internal_format);
+    image.format = header.gl_format;
+    image.type = header.gl_type;
+
+    size_t block_bytes = 0, pixel_bytes = 0;
+    if (image.compressed()) {
+        block_bytes = block_size(image.internal_format);
+    } else {
+        pixel_bytes = pixel_size(image.format, image.type);
+    }
+    if (block_bytes == 0 && pixel_bytes == 0) {
+        spdlog::error("\"{}\" has an unknown format 0x{:x} (format 0x{:x}, type 0x{:x})", filename, image.internal_format, image.format, image.type);
+        return {};
+    }
+
+    size_t offset = sizeof(KTX_IDENTIFIER) + sizeof(header) + header.bytes_of_key_value_data;
+    uint32_t level_count = std::max(header.number_of_mipmap_levels, 1u);
+    for (uint32_t level = 0; level < level_count; ++level) {
+        uint32_t image_size;
+        if (offset > data.size() || data.size() - offset < sizeof(image_size)) {
+            spdlog::error("\"{}\" is truncated at mip level {}", filename, level);
+            return {};
+        }
+        std::memcpy(&image_size, data.data() + offset, sizeof(image_size));
+        offset += sizeof(image_size);
+        if (data.size() - offset < image_size) {
+            spdlog::error("\"{}\" is truncated at mip level {}", filename, level);
+            return {};
+        }
+
+        TextureImage::Level mip;
+        mip.width = std::max(header.pixel_width >> level, 1u);
+        mip.height = std::max(header.pixel_height >> level, 1u);
+
+        // Compressed uploads must be exactly the size of the blocks covering
+        // the level. Uncompressed rows are read 4 byte aligned, which is the
+        // default GL_UNPACK_ALIGNMENT and how KTX pads them.
+        if (image.compressed()) {
+            size_t expected = size_t((mip.width + 3) / 4) * ((mip.height + 3) / 4) * block_bytes;
+            if (image_size != expected) {
+                spdlog::error("\"{}\" mip level {} is {} bytes, {}x{} in format 0x{:x} takes {}", filename, level, image_size, mip.width, mip.height, image.internal_format, expected);
+                return {};
+            }
+        } else {
+            size_t row_size = size_t(mip.width) * pixel_bytes;
+            size_t expected = ((row_size + 3) & ~size_t(3)) * (mip.height - 1) + row_size;
+            if (image_size < expected) {
+                spdlog::error("\"{}\" mip level {} is {} bytes, {}x{} needs at least {}", filename, level, image_size, mip.width, mip.height, expected);
+                return {};
+            }
+        }
+        mip.offset = offset;
+        mip.size = image_size;
+        image.levels.push_back(mip);
+
+        // Levels are padded to a multiple of 4 bytes
+        offset += (image_size + 3) & ~size_t(3);
+    }
+
+    spdlog::info("Loaded \"{}\": {}x{}, {} levels, format 0x{:x}{}", filename, header.pixel_width, header.pixel_height, level_count, image.internal_format, image.compressed() ? " (compressed)" : "");
+    return image;
+}
+
+TextureStreamer::TextureStreamer(size_t vram_budget, size_t upload_budget, unsigned worker_count)
+    : vram_budget(vram_budget)
+    , upload_budget(upload_budget)
+{
+    GLint format_count = 0;
+    glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &format_count);
+    std::vector<GLint> formats(format_count);
+    if (format_count > 0) {
+        glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats.data());
+    }
+    compressed_formats.assign(formats.begin(), formats.end());
+
+    glGenBuffers(PBO_COUNT, pbos);
+
+    for (unsigned i = 0; i < std::max(worker_count, 1u); ++i) {
+        workers.emplace_back(&TextureStreamer::worker_loop, this);
+    }
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    for (auto& texture : textures) {
+        glDeleteTextures(1, &texture.id);
+    }
+    glDeleteBuffers(PBO_COUNT, pbos);
+}
+
+size_t TextureStreamer::request(const std::string& filename)
+{
+    size_t id = textures.size();
+    StreamedTexture texture;
+    texture.filename = filename;
+    textures.push_back(std::move(texture));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.emplace_back(id, filename);
+    }
+    work_available.notify_one();
+    return id;
+}
+
+void TextureStreamer::worker_loop()
+{
+    while (true) {
+        std::pair<size_t, std::string> work;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_available.wait(lock, [this]() { return stopping || !pending.empty(); });
+            if (stopping) {
+                return;
+            }
+            work = std::move(pending.front());
+            pending.pop_front();
+        }
+
+        LoadResult result;
+        result.id = work.first;
+        auto image = load_ktx(work.second);
+        if (image) {
+            result.image = std::make_unique<TextureImage>(std::move(*image));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(std::move(result));
+        }
+        load_finished.notify_all();
+    }
+}
+
+bool TextureStreamer::receive(LoadResult& result)
+{
+    auto& texture = textures[result.id];
+    texture.received = true;
+    texture.image = std::move(result.image);
+    if (!texture.image) {
+        return false;
+    }
+    create_texture(texture);
+    return true;
+}
+
+bool TextureStreamer::update()
+{
+    std::vector<LoadResult> loaded;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        loaded.swap(finished);
+    }
+    bool touched_state = false;
+    for (auto& result : loaded) {
+        touched_state |= receive(result);
+    }
+
+    // Always allow one level per update so levels bigger than the upload
+    // budget still make progress
+    size_t uploaded = 0;
+    bool first_upload = true;
+    for (auto& texture : textures) {
+        while (texture.next_level >= 0 && (first_upload || uploaded < upload_budget)) {
+            uploaded += upload_level(texture);
+            first_upload = false;
+            touched_state = true;
+        }
+    }
+    return touched_state;
+}
+
+bool TextureStreamer::finish()
+{
+    size_t outstanding = std::count_if(textures.begin(), textures.end(), [](const StreamedTexture& texture) { return !texture.received; });
+    std::vector<LoadResult> loaded;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        load_finished.wait(lock, [this, outstanding]() { return finished.size() >= outstanding; });
+        loaded.swap(finished);
+    }
+    std::sort(loaded.begin(), loaded.end(), [](const LoadResult& a, const LoadResult& b) { return a.id < b.id; });
+
+    bool touched_state = false;
+    for (auto& result : loaded) {
+        touched_state |= receive(result);
+    }
+    for (auto& texture : textures) {
+        while (texture.next_level >= 0) {
+            upload_level(texture);
+            touched_state = true;
+        }
+    }
+    return touched_state;
+}
+
+GLuint TextureStreamer::texture(size_t id) const
+{
+    if (id >= textures.size() || !textures[id].resident) {
+        return 0;
+    }
+    return textures[id].id;
+}
+
+bool TextureStreamer::is_supported(GLenum internal_format) const
+{
+    return std::find(compressed_formats.begin(), compressed_formats.end(), internal_format) != compressed_formats.end();
+}
+
+void TextureStreamer::create_texture(StreamedTexture& texture)
+{
+    const TextureImage& image = *texture.image;
+    int level_count = image.levels.size();
+
+    // Compressed data is uploaded as is, the driver never gets to transcode it
+    if (image.compressed() && !is_supported(image.internal_format)) {
+        spdlog::error("\"{}\" uses compressed format 0x{:x}, which this GL implementation does not support", texture.filename, image.internal_format);
+        texture.image.reset();
+        return;
+    }
+
+    // Drop the finest levels until the rest of the chain fits the budget
+    size_t budget_left = vram_budget - std::min(vram_used_bytes, vram_budget);
+    size_t chain_size = 0;
+    int first_level = level_count;
+    for (int level = level_count - 1; level >= 0; --level) {
+        if (chain_size + image.levels[level].size > budget_left) {
+            break;
+        }
+        chain_size += image.levels[level].size;
+        first_level = level;
+    }
+    if (first_level == level_count) {
+        spdlog::warn("Not enough VRAM budget left for any level of \"{}\"", texture.filename);
+        texture.image.reset();
+        return;
+    }
+    if (first_level > 0) {
+        spdlog::info("Skipping the {} finest levels of \"{}\" to stay within the VRAM budget", first_level, texture.filename);
+    }
+
+    int storage_levels = level_count - first_level;
+    glGenTextures(1, &texture.id);
+    glBindTexture(GL_TEXTURE_2D, texture.id);
+    glTexStorage2D(GL_TEXTURE_2D, storage_levels, image.internal_format, image.levels[first_level].width, image.levels[first_level].height);
+    // Only the coarsest level is sampled until finer ones arrive
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, storage_levels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, storage_levels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    texture.first_level = first_level;
+    texture.next_level = level_count - 1;
+    vram_used_bytes += chain_size;
+}
+
+size_t TextureStreamer::upload_level(StreamedTexture& texture)
+{
+    const TextureImage& image = *texture.image;
+    const TextureImage::Level level = image.levels[texture.next_level];
+    GLint storage_level = texture.next_level - texture.first_level;
+
+    GLuint pbo = pbos[next_pbo];
+    next_pbo = (next_pbo + 1) % PBO_COUNT;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, level.size, nullptr, GL_STREAM_DRAW);
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, level.size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (!mapped) {
+        // Keep whatever levels made it so far
+        spdlog::error("Could not map the upload buffer for \"{}\"", texture.filename);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        texture.next_level = -1;
+        texture.image.reset();
+        return 0;
+    }
+    std::memcpy(mapped, image.data.data() + level.offset, level.size);
+    bool uploaded = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+
+    // Only errors of this upload should decide whether the level made it
+    while (glGetError() != GL_NO_ERROR) {
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture.id);
+    if (uploaded) {
+        if (image.compressed()) {
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, storage_level, 0, 0, level.width, level.height, image.internal_format, level.size, nullptr);
+        } else {
+            glTexSubImage2D(GL_TEXTURE_2D, storage_level, 0, 0, level.width, level.height, image.format, image.type, nullptr);
+        }
+        uploaded = glGetError() == GL_NO_ERROR;
+    }
+    if (uploaded) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, storage_level);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (!uploaded) {
+        // Keep sampling the levels that made it so far, if any
+        spdlog::error("Could not upload mip level {} of \"{}\"", texture.next_level, texture.filename);
+        texture.next_level = -1;
+        texture.image.reset();
+        return 0;
+    }
+    texture.resident = true;
+
+    texture.next_level--;
+    if (texture.next_level < texture.first_level) {
+        // Everything is on the GPU, the CPU copy is no longer needed
+        texture.next_level = -1;
+        texture.image.reset();
+        spdlog::debug("Finished streaming \"{}\"", texture.filename);
+    }
+    return level.size;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <epoxy/gl.h>
+
+// A 2D texture with its whole mip chain as stored in a KTX (version 1) file.
+// Compressed formats (BC, ETC2, ...) are kept exactly as they are on disk.
+struct TextureImage {
+    struct Level {
+        GLsizei width;
+        GLsizei height;
+        size_t offset; // into data
+        size_t size;
+    };
+
+    GLenum internal_format = 0;
+    GLenum format = 0; // 0 for compressed textures
+    GLenum type = 0; // 0 for compressed textures
+    std::vector<Level> levels; // finest first
+    std::string data;
+
+    bool compressed() const { return type == 0; }
+};
+
+std::optional<TextureImage> load_ktx(const std::string& filename);
+
+// Loads textures on worker threads and streams them into GL textures with
+// immutable storage, coarsest mip level first, through pixel buffer objects.
+// Only as many of the finest levels are dropped as needed to stay inside the
+// VRAM budget, and at most upload_budget bytes are uploaded per update.
+class TextureStreamer {
+public:
+    TextureStreamer(size_t vram_budget, size_t upload_budget, unsigned worker_count = 2);
+    ~TextureStreamer();
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    // Queues filename for loading, the returned id is valid right away
+    size_t request(const std::string& filename);
+
+    // Called once per frame on the GL thread, creates textures for finished
+    // loads and uploads the next mip levels. Returns whether it changed the
+    // texture bound to GL_TEXTURE_2D.
+    bool update();
+
+    // Waits for every requested texture to load and uploads all of their
+    // levels, ignoring the upload budget. Textures are created in request
+    // order, so which levels fit the VRAM budget does not depend on which
+    // load finished first. Replays call this so that every frame samples
+    // the same levels. Returns whether it changed the texture bound to
+    // GL_TEXTURE_2D.
+    bool finish();
+
+    // 0 until the coarsest level of the texture has been uploaded
+    GLuint texture(size_t id) const;
+
+    size_t vram_used() const { return vram_used_bytes; }
+
+private:
+    struct StreamedTexture {
+        std::string filename;
+        GLuint id = 0;
+        int first_level = 0; // finest level of the image that fits the budget
+        int next_level = -1; // next image level to upload, -1 when done
+        bool resident = false; // at least one level uploaded
+        bool received = false; // the load finished, successfully or not
+        std::unique_ptr<TextureImage> image;
+    };
+
+    struct LoadResult {
+        size_t id;
+        std::unique_ptr<TextureImage> image;
+    };
+
+    void worker_loop();
+    bool receive(LoadResult& result);
+    void create_texture(StreamedTexture& texture);
+    size_t upload_level(StreamedTexture& texture);
+
+    bool is_supported(GLenum internal_format) const;
+
+    size_t vram_budget;
+    size_t upload_budget;
+    size_t vram_used_bytes = 0;
+
+    std::vector<StreamedTexture> textures;
+    std::vector<GLenum> compressed_formats;
+
+    // Orphaned and refilled for every upload, cycled so the driver can keep
+    // earlier uploads in flight
+    static constexpr size_t PBO_COUNT = 3;
+    GLuint pbos[PBO_COUNT] = {};
+    size_t next_pbo = 0;
+
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable load_finished;
+    std::deque<std::pair<size_t, std::string>> pending; // id, filename
+    std::vector<LoadResult> finished;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
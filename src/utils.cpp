@@ -5,6 +5,11 @@
 #include <spdlog/spdlog.h>
 #include <string>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 std::optional<std::string> read_file(const std::string& filename)
 {
     std::ifstream file(filename);
@@ -23,3 +28,71 @@ std::optional<std::string> read_file(const std::string& filename)
 
     return buffer;
 }
+
+MappedFile::~MappedFile()
+{
+    unmap();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : mapping(other.mapping)
+    , length(other.length)
+{
+    other.mapping = nullptr;
+    other.length = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other) {
+        unmap();
+        mapping = other.mapping;
+        length = other.length;
+        other.mapping = nullptr;
+        other.length = 0;
+    }
+    return *this;
+}
+
+void MappedFile::unmap()
+{
+    if (mapping) {
+        munmap(mapping, length);
+        mapping = nullptr;
+        length = 0;
+    }
+}
+
+std::optional<MappedFile> map_file(const std::string& filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+        spdlog::error("Could not open \"{}\"", filename);
+        return {};
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        spdlog::error("Could not stat \"{}\"", filename);
+        close(fd);
+        return {};
+    }
+
+    MappedFile file;
+    if (st.st_size > 0) {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            spdlog::error("Could not map \"{}\"", filename);
+            close(fd);
+            return {};
+        }
+        // The whole file is about to be parsed front to back
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+        file.mapping = static_cast<unsigned char*>(p);
+        file.length = st.st_size;
+    }
+
+    // The mapping keeps the file contents alive on its own
+    close(fd);
+    return file;
+}
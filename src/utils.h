@@ -1,5 +1,61 @@
 #pragma once
+#include <algorithm>
+#include <cstddef>
 #include <optional>
 #include <string>
+#include <thread>
+#include <vector>
 
 std::optional<std::string> read_file(const std::string& filename);
+
+// Splits [0, count) into one contiguous range per hardware thread and calls
+// f(begin, end) for each of them concurrently, returning once all are done.
+// Ranges smaller than min_chunk are not worth a thread and are merged.
+template <typename F>
+void parallel_for(size_t count, F&& f, size_t min_chunk = 1024)
+{
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, (count + min_chunk - 1) / min_chunk);
+    if (threads <= 1) {
+        f(size_t(0), count);
+        return;
+    }
+
+    size_t chunk = (count + threads - 1) / threads;
+    std::vector<std::thread> workers;
+    for (size_t begin = chunk; begin < count; begin += chunk) {
+        size_t end = std::min(count, begin + chunk);
+        workers.emplace_back([&f, begin, end]() { f(begin, end); });
+    }
+    f(size_t(0), chunk);
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    const unsigned char* data() const { return mapping; }
+    size_t size() const { return length; }
+
+private:
+    friend std::optional<MappedFile> map_file(const std::string& filename);
+
+    void unmap();
+
+    unsigned char* mapping = nullptr;
+    size_t length = 0;
+};
+
+std::optional<MappedFile> map_file(const std::string& filename);